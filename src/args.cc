@@ -1,23 +1,45 @@
 #include "args.h"
+#include "real.h"
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <stdexcept>
 
 namespace poincare {
 
+// the settings that can be overridden per phase
+static const std::vector<std::string> PHASE_KEYS = {
+    "epochs", "start-lr", "end-lr", "number-negatives", "distribution-power"};
+// the settings that can be varied in a sweep (all configs share one sampler,
+// so the distribution power is not among them)
+static const std::vector<std::string> SWEEP_KEYS = {
+    "dimension", "start-lr", "end-lr", "number-negatives", "epochs", "init-range", "seed"};
+
 Args::Args() {
     start_lr = 0.5;
     end_lr = 0.5;
     dimension = 10;
+    manifold = "poincare";
     checkpoint_interval = -1;
+    snapshot_interval = -1;
     distribution_power = 0;
     epochs = 5;
     number_negatives = 10;
     threads = 4;
     init_range = 1e-4;
     seed = 1;
+    output_precision = std::numeric_limits<real>::digits10 + 1;
+    servers = 1;
+    workers = 1;
+    shard = 0;
+    worker_id = 0;
+    batch_size = 256;
+    deterministic = false;
+    staleness = 2;
 }
 
 void Args::parse_args(const std::vector<std::string>& args) {
@@ -46,16 +68,55 @@ void Args::parse_args(const std::vector<std::string>& args) {
                 distribution_power = std::stof(args.at(ai + 1));
             } else if (args[ai] == "-init-range") {
                 init_range = std::stof(args.at(ai + 1));
+            } else if (args[ai] == "-manifold") {
+                manifold = std::string(args.at(ai + 1));
+                if (manifold != "poincare" && manifold != "lorentz") {
+                    std::cerr << "Unknown manifold: " << manifold << std::endl;
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
             } else if (args[ai] == "-dimension") {
                 dimension = std::stoi(args.at(ai + 1));
             } else if (args[ai] == "-epochs") {
                 epochs = std::stoi(args.at(ai + 1));
             } else if (args[ai] == "-checkpoint-interval") {
                 checkpoint_interval = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-snapshot-interval") {
+                snapshot_interval = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-resume") {
+                resume = std::string(args.at(ai + 1));
             } else if (args[ai] == "-number-negatives") {
                 number_negatives = std::stoi(args.at(ai + 1));
             } else if (args[ai] == "-threads") {
                 threads = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-output-precision") {
+                output_precision = std::stoi(args.at(ai + 1));
+                if (output_precision < 1 || output_precision > std::numeric_limits<real>::max_digits10) {
+                    std::cerr << "-output-precision must be between 1 and "
+                              << std::numeric_limits<real>::max_digits10 << std::endl;
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+            } else if (args[ai] == "-phase") {
+                phase_specs.push_back(args.at(ai + 1));
+            } else if (args[ai] == "-sweep") {
+                sweep_specs.push_back(args.at(ai + 1));
+            } else if (args[ai] == "-endpoints") {
+                endpoints = std::string(args.at(ai + 1));
+            } else if (args[ai] == "-servers") {
+                servers = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-workers") {
+                workers = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-shard") {
+                shard = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-worker-id") {
+                worker_id = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-batch-size") {
+                batch_size = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-staleness") {
+                staleness = std::stoi(args.at(ai + 1));
+            } else if (args[ai] == "-deterministic") {
+                deterministic = std::stoi(args.at(ai + 1)) != 0;
             } else if (args[ai] == "-seed") {
                 seed = std::stoi(args.at(ai + 1));
             } else {
@@ -69,11 +130,137 @@ void Args::parse_args(const std::vector<std::string>& args) {
             exit(EXIT_FAILURE);
         }
     }
+    if (batch_size < 1) {
+        std::cerr << "-batch-size must be positive" << std::endl;
+        print_help();
+        exit(EXIT_FAILURE);
+    }
     if (graph.empty() || output_vectors.empty()) {
         std::cerr << "Empty graph or output-vectors path." << std::endl;
         print_help();
         exit(EXIT_FAILURE);
     }
+    try {
+        phases();
+        sweep_configs();
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+std::vector<std::shared_ptr<Args>> Args::phases() const {
+    std::vector<std::shared_ptr<Args>> result;
+    if (phase_specs.empty()) {
+        result.push_back(std::make_shared<Args>(*this));
+        return result;
+    }
+    for (auto spec = phase_specs.begin(); spec != phase_specs.end(); ++spec) {
+        std::shared_ptr<Args> phase = std::make_shared<Args>(*this);
+        phase->phase_specs.clear();
+        std::stringstream spec_stream(*spec);
+        std::string setting;
+        while (std::getline(spec_stream, setting, ',')) {
+            size_t eq = setting.find('=');
+            if (eq == std::string::npos) {
+                throw std::invalid_argument("Phase setting without '=': " + setting);
+            }
+            std::string key = setting.substr(0, eq);
+            std::string value = setting.substr(eq + 1);
+            phase->set_option(key, value, PHASE_KEYS);
+        }
+        result.push_back(phase);
+    }
+    return result;
+}
+
+std::string Args::schedule() const {
+    std::ostringstream result;
+    result.precision(std::numeric_limits<double>::max_digits10);
+    std::vector<std::shared_ptr<Args>> all_phases = phases();
+    for (size_t p = 0; p < all_phases.size(); p++) {
+        const Args& phase = *all_phases[p];
+        result << (p > 0 ? ";" : "") << "epochs=" << phase.epochs << ",start-lr=" << phase.start_lr
+               << ",end-lr=" << phase.end_lr << ",number-negatives=" << phase.number_negatives
+               << ",distribution-power=" << phase.distribution_power;
+    }
+    // the batch size only changes the order of the updates when deterministic
+    if (deterministic) {
+        result << ";deterministic,batch-size=" << batch_size;
+    }
+    return result.str();
+}
+
+std::vector<std::shared_ptr<Args>> Args::sweep_configs() const {
+    std::vector<std::shared_ptr<Args>> result;
+    std::shared_ptr<Args> base = std::make_shared<Args>(*this);
+    base->sweep_specs.clear();
+    result.push_back(base);
+    for (auto spec = sweep_specs.begin(); spec != sweep_specs.end(); ++spec) {
+        size_t eq = spec->find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument("Sweep spec without '=': " + *spec);
+        }
+        std::string key = spec->substr(0, eq);
+        for (auto phase_spec = phase_specs.begin(); phase_spec != phase_specs.end(); ++phase_spec) {
+            std::stringstream settings(*phase_spec);
+            std::string setting;
+            while (std::getline(settings, setting, ',')) {
+                if (setting.substr(0, setting.find('=')) == key) {
+                    throw std::invalid_argument("Cannot sweep " + key + ", since a phase sets it");
+                }
+            }
+        }
+        std::vector<std::string> values;
+        std::stringstream values_stream(spec->substr(eq + 1));
+        std::string value;
+        while (std::getline(values_stream, value, ',')) {
+            values.push_back(value);
+        }
+        if (values.empty()) {
+            throw std::invalid_argument("Sweep spec without values: " + *spec);
+        }
+        std::vector<std::shared_ptr<Args>> expanded;
+        for (auto config = result.begin(); config != result.end(); ++config) {
+            for (auto v = values.begin(); v != values.end(); ++v) {
+                std::shared_ptr<Args> point = std::make_shared<Args>(**config);
+                point->set_option(key, *v, SWEEP_KEYS);
+                expanded.push_back(point);
+            }
+        }
+        result.swap(expanded);
+    }
+    return result;
+}
+
+void Args::set_option(const std::string& key, const std::string& value,
+                      const std::vector<std::string>& allowed_keys) {
+    if (std::find(allowed_keys.begin(), allowed_keys.end(), key) == allowed_keys.end()) {
+        throw std::invalid_argument("Setting cannot be used here: " + key);
+    }
+    try {
+        if (key == "epochs") {
+            epochs = std::stoi(value);
+        } else if (key == "start-lr") {
+            start_lr = std::stof(value);
+        } else if (key == "end-lr") {
+            end_lr = std::stof(value);
+        } else if (key == "number-negatives") {
+            number_negatives = std::stoi(value);
+        } else if (key == "distribution-power") {
+            distribution_power = std::stof(value);
+        } else if (key == "dimension") {
+            dimension = std::stoi(value);
+        } else if (key == "init-range") {
+            init_range = std::stof(value);
+        } else if (key == "seed") {
+            seed = std::stoi(value);
+        }
+    } catch (const std::logic_error&) {
+        // std::stoi and std::stof raise invalid_argument or out_of_range
+        throw std::invalid_argument("Bad value for setting " + key + ": " + value);
+    }
 }
 
 void Args::print_help() {
@@ -84,13 +271,28 @@ void Args::print_help() {
         << "    -start-lr                   start learning rate [" << start_lr << "]\n"
         << "    -end-lr                     end learning rate [" << end_lr << "]\n"
         << "    -dimension                  manifold dimension [" << dimension << "]\n"
+        << "    -manifold                   model of hyperbolic space to train in, poincare or lorentz [" << manifold << "]\n"
         << "    -init-range                 range of components for uniform initialization [" << init_range << "]\n"
         << "    -epochs                     number of epochs [" << epochs << "]\n"
         << "    -number-negatives           number of negatives sampled [" << number_negatives << "]\n"
         << "    -distribution-power         exponent to use to modify negative sampling distribution [" << distribution_power << "]\n"
+        << "    -phase                      training phase, e.g. epochs=40,start-lr=0.005,distribution-power=1\n"
+        << "                                  (repeatable; unset keys default to the flags above)\n"
+        << "    -sweep                      sweep mode only: grid values, e.g. dimension=5,10,20 (repeatable)\n"
+        << "    -endpoints                  distributed modes: comma-separated server endpoints, host:port or socket path\n"
+        << "    -servers                    cluster mode: number of server processes [" << servers << "]\n"
+        << "    -workers                    distributed modes: number of worker processes [" << workers << "]\n"
+        << "    -shard                      server mode: shard served by this process [" << shard << "]\n"
+        << "    -worker-id                  worker mode: id of this worker [" << worker_id << "]\n"
+        << "    -batch-size                 distributed and deterministic modes: edges trained per thread between synchronisations [" << batch_size << "]\n"
+        << "    -staleness                  distributed modes: batches a cached row is reused before re-pulling [" << staleness << "]\n"
         << "    -checkpoint-interval        save vectors every this many epochs [" << checkpoint_interval << "]\n"
+        << "    -output-precision           significant digits of written vector components, 1 to " << std::numeric_limits<real>::max_digits10 << " [" << output_precision << "]\n"
+        << "    -snapshot-interval          save the full training state to <output-vectors>.state every this many epochs [" << snapshot_interval << "]\n"
+        << "    -resume                     resume training from a saved training state (optional)\n"
         << "    -threads                    number of threads [" << threads << "]\n"
         << "    -seed                       seed for the random number generator [" << seed << "]\n"
-        << "                                  n.b. only deterministic if single threaded!\n";
+        << "                                  n.b. only deterministic if single threaded, or with -deterministic 1\n"
+        << "    -deterministic              reproducible multi-threaded training, in synchronised rounds of -batch-size edges per thread [" << deterministic << "]\n";
 }
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -15,14 +16,75 @@ class Args {
         double end_lr;
         int seed;
         int dimension;
+        std::string manifold;
         int checkpoint_interval;
+        int snapshot_interval;
+        std::string resume;
         double distribution_power;
         int epochs;
         int number_negatives;
         int threads;
         double init_range;
+        int output_precision;
+        bool deterministic;
+        /**
+         * Training phases as given by repeated -phase flags, each a
+         * comma-separated list of key=value overrides, e.g.
+         *   epochs=40,start-lr=0.005,end-lr=0.005,distribution-power=1
+         */
+        std::vector<std::string> phase_specs;
+        /**
+         * Hyperparameter grid as given by repeated -sweep flags (sweep mode
+         * only), each a key and a comma-separated list of values, e.g.
+         *   dimension=5,10,20
+         */
+        std::vector<std::string> sweep_specs;
+        // distributed training (see distributed.h)
+        std::string endpoints;
+        int servers;
+        int workers;
+        int shard;
+        int worker_id;
+        int batch_size;
+        int staleness;
 
     void parse_args(const std::vector<std::string>& args);
     void print_help();
+
+    /**
+     * Return the Args of each training phase, in order: a copy of these Args
+     * with the overrides of the corresponding phase spec applied, or a single
+     * copy of these Args if no phases were specified.
+     * Raises an invalid_argument if a phase spec is malformed.
+     */
+    std::vector<std::shared_ptr<Args>> phases() const;
+
+    /**
+     * Return a description of the learning rate and sampling schedule: the
+     * epochs, learning rates, negatives and distribution power of every
+     * phase, and the batch size if deterministic, with the numbers written
+     * exactly, so that two schedules are equal iff their descriptions are.
+     * Raises an invalid_argument if a phase spec is malformed.
+     */
+    std::string schedule() const;
+
+    /**
+     * Return the Args of each point of the sweep grid: a copy of these Args
+     * for every combination of the values of the sweep specs, the last spec
+     * varying fastest.
+     * Raises an invalid_argument if a sweep spec is malformed, or sweeps a
+     * setting that a phase spec overrides (which would silently win).
+     */
+    std::vector<std::shared_ptr<Args>> sweep_configs() const;
+
+    protected:
+        /**
+         * Set the setting named `key` (the name of its flag, without the dash)
+         * to `value`, provided it is one of `allowed_keys`.
+         * Raises an invalid_argument if the key is not allowed or the value
+         * cannot be parsed.
+         */
+        void set_option(const std::string& key, const std::string& value,
+                        const std::vector<std::string>& allowed_keys);
 };
 }
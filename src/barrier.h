@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace poincare {
+
+/**
+ * A reusable barrier for a fixed number of threads.
+ */
+class Barrier {
+    protected:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        const int32_t count_;
+        int32_t waiting_;
+        int64_t generation_;
+
+    public:
+        explicit Barrier(int32_t count) : count_(count), waiting_(0), generation_(0) {}
+
+        /**
+         * Block until all `count` threads have called wait.
+         */
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            int64_t generation = generation_;
+            if (++waiting_ == count_) {
+                waiting_ = 0;
+                generation_++;
+                cv_.notify_all();
+            } else {
+                cv_.wait(lock, [this, generation]() { return generation != generation_; });
+            }
+        }
+};
+
+}
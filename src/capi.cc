@@ -0,0 +1,361 @@
+#include "capi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "args.h"
+#include "digraph.h"
+#include "io.h"
+#include "manifold.h"
+#include "poincare.h"
+#include "vector.h"
+
+using namespace poincare;
+
+struct poincare_graph {
+    std::shared_ptr<Digraph> digraph;
+};
+
+struct poincare_embedding {
+    std::shared_ptr<Args> args;
+    std::shared_ptr<Digraph> digraph;
+    // the rows, in the coordinates of args->manifold
+    std::shared_ptr<std::vector<Vector>> vectors;
+};
+
+// the description of the last failure on this thread
+static thread_local std::string last_error;
+
+/**
+ * Return the result of `function`, or `failure` if it raises, recording the
+ * exception in last_error; no exception may cross the C interface.
+ */
+template <typename Result, typename Function>
+static Result guard(Result failure, Function function) {
+    last_error.clear();
+    try {
+        return function();
+    } catch (const std::exception& e) {
+        last_error = e.what();
+    } catch (...) {
+        last_error = "unknown error";
+    }
+    return failure;
+}
+
+static void check_node(int64_t node, int64_t node_count) {
+    if (node < 0 || node >= node_count) {
+        throw std::out_of_range("no such node: " + std::to_string(node));
+    }
+}
+
+static std::shared_ptr<Args> args_from_options(const poincare_options& options, int64_t node_count) {
+    std::shared_ptr<Args> args = std::make_shared<Args>();
+    args->dimension = options.dimension;
+    if (options.manifold != nullptr) {
+        args->manifold = options.manifold;
+    }
+    args->epochs = options.epochs;
+    args->start_lr = options.start_lr;
+    args->end_lr = options.end_lr;
+    args->number_negatives = options.number_negatives;
+    args->distribution_power = options.distribution_power;
+    args->init_range = options.init_range;
+    args->threads = options.threads;
+    args->seed = options.seed;
+    args->deterministic = (options.deterministic != 0);
+    args->batch_size = options.batch_size;
+    if (args->manifold != "poincare" && args->manifold != "lorentz") {
+        throw std::invalid_argument("unknown manifold: " + args->manifold);
+    }
+    if (args->dimension < 1 || args->epochs < 1 || args->threads < 1 || args->batch_size < 1) {
+        throw std::invalid_argument("dimension, epochs, threads and batch_size must be positive");
+    }
+    if (args->number_negatives < 1 || args->number_negatives >= node_count) {
+        throw std::invalid_argument("number_negatives must be positive and less than the number of nodes");
+    }
+    return args;
+}
+
+/**
+ * Run `work(t)` for t = 0, ..., threads - 1 on as many threads.
+ */
+template <typename Work>
+static void run_in_parallel(int threads, Work work) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&, t]() { work(t); }));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+}
+
+template <class Manifold>
+static void find_nearest(const std::vector<Vector>& vectors, const int64_t* queries, int64_t query_count,
+                         int32_t k, int64_t* neighbours, poincare_real* distances, int threads) {
+    const int64_t node_count = vectors.size();
+    std::vector<real> scalars(node_count);
+    for (int64_t i = 0; i < node_count; i++) {
+        scalars[i] = Manifold::point_scalar(vectors[i]);
+    }
+    run_in_parallel(threads, [&](int t) {
+        // a max-heap of the (arccosh argument, node) of the k nearest so far;
+        // the arccosh argument increases with the distance
+        std::vector<std::pair<real, int64_t>> nearest;
+        for (int64_t q = t; q < query_count; q += threads) {
+            const int64_t query = queries[q];
+            nearest.clear();
+            for (int64_t c = 0; c < node_count; c++) {
+                if (c == query) {
+                    continue;
+                }
+                real arg = Manifold::arccosh_arg(vectors[query], vectors[c], scalars[query], scalars[c]);
+                if (nearest.size() < k) {
+                    nearest.push_back(std::make_pair(arg, c));
+                    std::push_heap(nearest.begin(), nearest.end());
+                } else if (arg < nearest.front().first) {
+                    std::pop_heap(nearest.begin(), nearest.end());
+                    nearest.back() = std::make_pair(arg, c);
+                    std::push_heap(nearest.begin(), nearest.end());
+                }
+            }
+            std::sort_heap(nearest.begin(), nearest.end());
+            for (int32_t n = 0; n < k; n++) {
+                bool found = n < nearest.size();
+                neighbours[q * k + n] = found ? nearest[n].second : -1;
+                if (distances != nullptr) {
+                    distances[q * k + n] = found ? std::acosh(std::max(nearest[n].first, real(1)))
+                                                 : std::numeric_limits<poincare_real>::infinity();
+                }
+            }
+        }
+    });
+}
+
+template <class Manifold>
+static void compute_distances(const std::vector<Vector>& vectors, const int64_t* sources, const int64_t* targets,
+                              int64_t count, poincare_real* distances) {
+    for (int64_t i = 0; i < count; i++) {
+        distances[i] = distance<Manifold>(vectors[sources[i]], vectors[targets[i]]);
+    }
+}
+
+/**
+ * Return the number of entries of the negative sampling table for `options`
+ * on a graph of `node_count` nodes.
+ */
+static int64_t negative_table_size(const poincare_options& options, int64_t node_count) {
+    if (options.negative_table_size < 0) {
+        throw std::invalid_argument("negative_table_size must not be negative");
+    }
+    if (options.negative_table_size > 0) {
+        return options.negative_table_size;
+    }
+    return std::min<int64_t>(NEGATIVE_TABLE_SIZE, NEGATIVE_TABLE_ENTRIES_PER_NODE * node_count);
+}
+
+/**
+ * Fill all of `options` with the defaults.
+ */
+static void fill_default_options(poincare_options* options) {
+    Args defaults;
+    options->struct_size = sizeof(poincare_options);
+    options->dimension = defaults.dimension;
+    options->manifold = "poincare";
+    options->epochs = defaults.epochs;
+    options->start_lr = defaults.start_lr;
+    options->end_lr = defaults.end_lr;
+    options->number_negatives = defaults.number_negatives;
+    options->distribution_power = defaults.distribution_power;
+    options->init_range = defaults.init_range;
+    options->threads = 1;
+    options->seed = defaults.seed;
+    options->deterministic = defaults.deterministic ? 1 : 0;
+    options->batch_size = defaults.batch_size;
+    options->verbose = 0;
+    options->negative_table_size = 0;
+}
+
+extern "C" {
+
+int32_t poincare_version(void) {
+    return POINCARE_CAPI_VERSION;
+}
+
+const char* poincare_last_error(void) {
+    return last_error.c_str();
+}
+
+void poincare_init_options(poincare_options* options, size_t struct_size) {
+    poincare_options defaults;
+    fill_default_options(&defaults);
+    defaults.struct_size = std::min(struct_size, sizeof(poincare_options));
+    memcpy(options, &defaults, defaults.struct_size);
+}
+
+poincare_graph* poincare_graph_create(const char* const* sources, const char* const* targets, int64_t edge_count) {
+    return guard<poincare_graph*>(nullptr, [&]() {
+        std::unique_ptr<poincare_graph> graph(new poincare_graph());
+        graph->digraph = std::make_shared<Digraph>();
+        for (int64_t i = 0; i < edge_count; i++) {
+            if (sources[i] == nullptr || targets[i] == nullptr) {
+                throw std::invalid_argument("null node name in edge " + std::to_string(i));
+            }
+            graph->digraph->add_edge(sources[i], targets[i]);
+        }
+        return graph.release();
+    });
+}
+
+poincare_graph* poincare_graph_create_from_ids(const int64_t* sources, const int64_t* targets, int64_t edge_count) {
+    return guard<poincare_graph*>(nullptr, [&]() {
+        std::unique_ptr<poincare_graph> graph(new poincare_graph());
+        graph->digraph = std::make_shared<Digraph>();
+        for (int64_t i = 0; i < edge_count; i++) {
+            graph->digraph->add_edge(std::to_string(sources[i]), std::to_string(targets[i]));
+        }
+        return graph.release();
+    });
+}
+
+void poincare_graph_free(poincare_graph* graph) {
+    delete graph;
+}
+
+int64_t poincare_graph_node_count(const poincare_graph* graph) {
+    return graph->digraph->enumeration2node.size();
+}
+
+const char* poincare_graph_node_name(const poincare_graph* graph, int64_t node) {
+    return guard<const char*>(nullptr, [&]() {
+        check_node(node, graph->digraph->enumeration2node.size());
+        return graph->digraph->enumeration2node[node]->name.c_str();
+    });
+}
+
+int64_t poincare_graph_node_id(const poincare_graph* graph, const char* name) {
+    auto it = graph->digraph->name2node.find(name);
+    return (it == graph->digraph->name2node.end()) ? -1 : it->second->enumeration;
+}
+
+poincare_embedding* poincare_train(const poincare_graph* graph, const poincare_options* options,
+                                   poincare_progress_callback progress, void* user_data) {
+    return guard<poincare_embedding*>(nullptr, [&]() {
+        if (options->struct_size < sizeof(options->struct_size) || options->struct_size > sizeof(poincare_options)) {
+            throw std::invalid_argument("options of unknown size " + std::to_string(options->struct_size)
+                    + " (not initialised by poincare_default_options, or from a newer version?)");
+        }
+        // fields unknown to the caller take their defaults
+        poincare_options known;
+        fill_default_options(&known);
+        memcpy(&known, options, options->struct_size);
+        std::unique_ptr<poincare_embedding> embedding(new poincare_embedding());
+        embedding->digraph = graph->digraph;
+        embedding->args = args_from_options(known, graph->digraph->node_count());
+        std::shared_ptr<Args> args = embedding->args;
+        // the trainer and its sampler are discarded once trained
+        int64_t table_size = negative_table_size(known, graph->digraph->node_count());
+        Poincare trainer(args, graph->digraph,
+                         Poincare::build_sampler(*graph->digraph, args->distribution_power, table_size));
+        trainer.set_verbose(known.verbose != 0);
+        if (progress != nullptr) {
+            trainer.set_epoch_callback([=](int32_t epochs_trained, real objective) {
+                return progress(epochs_trained, args->epochs, objective, user_data) == 0;
+            });
+        }
+        trainer.train();
+        embedding->vectors = trainer.get_vectors();
+        return embedding.release();
+    });
+}
+
+void poincare_embedding_free(poincare_embedding* embedding) {
+    delete embedding;
+}
+
+int64_t poincare_embedding_node_count(const poincare_embedding* embedding) {
+    return embedding->vectors->size();
+}
+
+int64_t poincare_embedding_coordinates(const poincare_embedding* embedding) {
+    return manifold_coordinates(embedding->args->manifold, embedding->args->dimension);
+}
+
+const poincare_real* poincare_embedding_row(const poincare_embedding* embedding, int64_t node) {
+    return guard<const poincare_real*>(nullptr, [&]() {
+        check_node(node, embedding->vectors->size());
+        return (*embedding->vectors)[node].data_;
+    });
+}
+
+int poincare_embedding_rows(const poincare_embedding* embedding, const poincare_real** rows) {
+    for (size_t i = 0; i < embedding->vectors->size(); i++) {
+        rows[i] = (*embedding->vectors)[i].data_;
+    }
+    return 0;
+}
+
+int poincare_embedding_save(const poincare_embedding* embedding, const char* fn) {
+    return guard<int>(-1, [&]() {
+        const Args& args = *embedding->args;
+        if (!is_lorentz(args.manifold)) {
+            write_vectors(fn, *embedding->digraph, *embedding->vectors, args.output_precision, args.threads);
+            return 0;
+        }
+        // vectors are always written in Poincaré ball coordinates
+        std::vector<Vector> ball(embedding->vectors->size(), Vector(args.dimension));
+        for (size_t i = 0; i < ball.size(); i++) {
+            Lorentz::to_ball((*embedding->vectors)[i], ball[i]);
+        }
+        write_vectors(fn, *embedding->digraph, ball, args.output_precision, args.threads);
+        return 0;
+    });
+}
+
+int poincare_distances(const poincare_embedding* embedding, const int64_t* sources, const int64_t* targets,
+                       int64_t count, poincare_real* distances) {
+    return guard<int>(-1, [&]() {
+        const std::vector<Vector>& vectors = *embedding->vectors;
+        for (int64_t i = 0; i < count; i++) {
+            check_node(sources[i], vectors.size());
+            check_node(targets[i], vectors.size());
+        }
+        if (is_lorentz(embedding->args->manifold)) {
+            compute_distances<Lorentz>(vectors, sources, targets, count, distances);
+        } else {
+            compute_distances<PoincareBall>(vectors, sources, targets, count, distances);
+        }
+        return 0;
+    });
+}
+
+int poincare_knn(const poincare_embedding* embedding, const int64_t* queries, int64_t query_count,
+                 int32_t k, int64_t* neighbours, poincare_real* distances) {
+    return guard<int>(-1, [&]() {
+        const std::vector<Vector>& vectors = *embedding->vectors;
+        if (k < 0) {
+            throw std::invalid_argument("k must not be negative");
+        }
+        for (int64_t q = 0; q < query_count; q++) {
+            check_node(queries[q], vectors.size());
+        }
+        int threads = std::max<int64_t>(std::min<int64_t>(embedding->args->threads, query_count), 1);
+        if (is_lorentz(embedding->args->manifold)) {
+            find_nearest<Lorentz>(vectors, queries, query_count, k, neighbours, distances, threads);
+        } else {
+            find_nearest<PoincareBall>(vectors, queries, query_count, k, neighbours, distances, threads);
+        }
+        return 0;
+    });
+}
+
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+/*
+ * C interface to libpoincare, for training and querying embeddings in
+ * process, without the file round-trips of the command line tool.
+ *
+ * Graphs and embeddings are opaque handles, freed by the corresponding
+ * *_free function.  Functions returning a pointer return NULL on failure, and
+ * those returning an int return 0 on success and -1 on failure; in either
+ * case poincare_last_error() then describes the failure.  Nodes are
+ * identified by their enumeration, 0 <= node < poincare_graph_node_count(),
+ * in order of first appearance in the edges.
+ *
+ * The ABI is stable within a major version (POINCARE_CAPI_VERSION): fields
+ * are only ever appended to poincare_options, whose leading struct_size
+ * tells the library how many of them the caller knows of (the rest taking
+ * their defaults).  Always initialise it with poincare_default_options.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POINCARE_CAPI_VERSION 1
+
+#if defined(__GNUC__)
+#define POINCARE_API __attribute__((visibility("default")))
+#else
+#define POINCARE_API
+#endif
+
+/* the floating point type of the embeddings (real, in the C++ sources) */
+typedef long double poincare_real;
+
+typedef struct poincare_graph poincare_graph;
+typedef struct poincare_embedding poincare_embedding;
+
+typedef struct poincare_options {
+    /* sizeof(poincare_options) as compiled by the caller */
+    uint32_t struct_size;
+    int32_t dimension;
+    /* "poincare" or "lorentz" */
+    const char* manifold;
+    int32_t epochs;
+    double start_lr;
+    double end_lr;
+    int32_t number_negatives;
+    double distribution_power;
+    double init_range;
+    int32_t threads;
+    int32_t seed;
+    /* non-zero for reproducible multi-threaded training */
+    int32_t deterministic;
+    int32_t batch_size;
+    /* non-zero to report progress on stderr */
+    int32_t verbose;
+    /* entries of the negative sampling table; 0 sizes it from the number of
+       nodes (the command line tool always uses 100000000) */
+    int64_t negative_table_size;
+} poincare_options;
+
+/**
+ * Called after every epoch with the number of epochs trained so far, the
+ * total number of epochs and the mean objective of the epoch.  Training stops
+ * early if it returns non-zero.
+ */
+typedef int (*poincare_progress_callback)(int32_t epochs_trained, int32_t epochs, double objective, void* user_data);
+
+/**
+ * Return POINCARE_CAPI_VERSION of the library.
+ */
+POINCARE_API int32_t poincare_version(void);
+
+/**
+ * Return a description of the last failure on this thread, or an empty
+ * string.  The string is valid until the next call on this thread.
+ */
+POINCARE_API const char* poincare_last_error(void);
+
+/**
+ * Fill the first `struct_size` bytes of `options` with the defaults of the
+ * command line tool (but a single thread, and quiet), setting struct_size.
+ * Use through poincare_default_options.
+ */
+POINCARE_API void poincare_init_options(poincare_options* options, size_t struct_size);
+
+#define poincare_default_options(options) poincare_init_options((options), sizeof(poincare_options))
+
+/**
+ * Build a graph from `edge_count` edges, the ith from the node named
+ * sources[i] to that named targets[i].  The names are copied.
+ */
+POINCARE_API poincare_graph* poincare_graph_create(const char* const* sources, const char* const* targets,
+                                                   int64_t edge_count);
+
+/**
+ * Like poincare_graph_create, for nodes identified by integers (the name of
+ * a node is then its integer in decimal).
+ */
+POINCARE_API poincare_graph* poincare_graph_create_from_ids(const int64_t* sources, const int64_t* targets,
+                                                            int64_t edge_count);
+
+POINCARE_API void poincare_graph_free(poincare_graph* graph);
+
+POINCARE_API int64_t poincare_graph_node_count(const poincare_graph* graph);
+
+/**
+ * Return the name of the node, valid for the lifetime of the graph, or NULL
+ * if there is no such node.
+ */
+POINCARE_API const char* poincare_graph_node_name(const poincare_graph* graph, int64_t node);
+
+/**
+ * Return the node with the given name, or -1 if there is none.
+ */
+POINCARE_API int64_t poincare_graph_node_id(const poincare_graph* graph, const char* name);
+
+/**
+ * Train an embedding of the graph.  `progress` may be NULL.  The embedding
+ * shares the graph, which may be freed before it.  Fails if options come
+ * from a newer version of the library (a larger struct_size).
+ */
+POINCARE_API poincare_embedding* poincare_train(const poincare_graph* graph, const poincare_options* options,
+                                                poincare_progress_callback progress, void* user_data);
+
+POINCARE_API void poincare_embedding_free(poincare_embedding* embedding);
+
+POINCARE_API int64_t poincare_embedding_node_count(const poincare_embedding* embedding);
+
+/**
+ * Return the number of components of each row: the dimension for the
+ * Poincaré ball, one more for the Lorentz model (whose rows hold the
+ * coordinates on the hyperboloid, first coordinate first).
+ */
+POINCARE_API int64_t poincare_embedding_coordinates(const poincare_embedding* embedding);
+
+/**
+ * Return the row of the node, without copying, or NULL if there is no such
+ * node.  Rows are separately allocated, so the pointers of different rows
+ * are not related; they are valid for the lifetime of the embedding.
+ */
+POINCARE_API const poincare_real* poincare_embedding_row(const poincare_embedding* embedding, int64_t node);
+
+/**
+ * Fill rows[i] with poincare_embedding_row(embedding, i) for every node.
+ */
+POINCARE_API int poincare_embedding_rows(const poincare_embedding* embedding, const poincare_real** rows);
+
+/**
+ * Write the embedding to `fn` in the format of the command line tool (in
+ * Poincaré ball coordinates, whatever the manifold).
+ */
+POINCARE_API int poincare_embedding_save(const poincare_embedding* embedding, const char* fn);
+
+/**
+ * Set distances[i] to the hyperbolic distance between nodes sources[i] and
+ * targets[i], for 0 <= i < count.
+ */
+POINCARE_API int poincare_distances(const poincare_embedding* embedding, const int64_t* sources,
+                                    const int64_t* targets, int64_t count, poincare_real* distances);
+
+/**
+ * For each of the `query_count` query nodes, find the `k` other nodes
+ * nearest to it, writing them in order of increasing distance to
+ * neighbours[q * k], ..., neighbours[q * k + k - 1] and their distances to
+ * the same entries of `distances` (which may be NULL).  If there are fewer
+ * than k other nodes, the remaining entries are -1 and infinity.  Queries are
+ * answered by the number of threads the embedding was trained with.
+ */
+POINCARE_API int poincare_knn(const poincare_embedding* embedding, const int64_t* queries, int64_t query_count,
+                              int32_t k, int64_t* neighbours, poincare_real* distances);
+
+#ifdef __cplusplus
+}
+#endif
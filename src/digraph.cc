@@ -20,15 +20,21 @@ Digraph::Digraph(std::istream& in) {
         if (fields.size() != 2) {
             throw std::runtime_error("expected exactly two tab-separated columns at line " + std::to_string(edges.size()));
         }
-        Node& source = find_or_create_node(fields[0]);
-        Node& target = find_or_create_node(fields[1]);
-        Edge* edge_ptr = new Edge(source, target);
-        edges.push_back(edge_ptr);
+        add_edge(fields[0], fields[1]);
     }
     std::cerr << "\rRead " << edges.size() << " edges." << std::endl;
     std::cerr << "Number of nodes: " << node_count() << std::endl;
 }
 
+Digraph::Digraph() {}
+
+void Digraph::add_edge(const std::string& source_name, const std::string& target_name) {
+    Node& source = find_or_create_node(source_name);
+    Node& target = find_or_create_node(target_name);
+    Edge* edge_ptr = new Edge(source, target);
+    edges.push_back(edge_ptr);
+}
+
 Digraph::~Digraph() {
     for (int32_t i=0; i < edges.size(); i++) {
         delete edges[i];
@@ -50,9 +50,20 @@ class Digraph {
          * + enumeration2node[n].enumeration == n for all 0 <= n < node_count()
          */
         Digraph(std::istream& in);
+
+        /**
+         * Create an empty Digraph, to which edges are added by add_edge.
+         */
+        Digraph();
         ~Digraph();
         int64_t const node_count();
 
+        /**
+         * Append an edge from the node named `source_name` to that named
+         * `target_name`, creating the nodes if necessary.
+         */
+        void add_edge(const std::string& source_name, const std::string& target_name);
+
     protected:
         /**
          * Return a reference to the Node with that name,
@@ -0,0 +1,954 @@
+#include "distributed.h"
+#include "io.h"
+#include "poincare.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace poincare {
+
+// how long a worker keeps retrying to connect to a server that isn't up yet
+constexpr int32_t CONNECT_TIMEOUT_MS = 60000;
+constexpr int32_t CONNECT_RETRY_MS = 50;
+// identifies the protocol, and reads differently on a host of the other byte order
+constexpr uint32_t PROTOCOL_MAGIC = 0x504f4e43;
+// bumped on any change to the messages
+constexpr uint32_t PROTOCOL_VERSION = 2;
+
+enum MessageType : uint32_t {
+    PULL = 1,     // ids -> rows
+    PUSH = 2,     // ids, row changes -> (no reply)
+    FINISHED = 3, // -> (no reply)
+    WAIT = 4,     // -> number of workers lost, once every worker has finished or been lost
+    SHUTDOWN = 5, // -> (no reply)
+    HELLO = 6     // Hello -> Hello (the first message on every connection)
+};
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t count;
+};
+
+/**
+ * Exchanged when a worker connects, so that processes that would interpret
+ * the rows differently (another version, architecture or configuration) fail
+ * fast instead of silently desynchronising the stream.
+ */
+struct Hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t real_size;
+    uint32_t real_digits;
+    uint32_t coordinates;
+    uint32_t lorentz;
+    uint32_t node_count;
+    uint32_t shard_count;
+    uint32_t worker_count;
+    uint32_t worker_id; // of the worker (unused in the reply of a server)
+};
+
+static Hello make_hello(const Args& args, int64_t node_count, int32_t shard_count) {
+    Hello hello;
+    hello.magic = PROTOCOL_MAGIC;
+    hello.version = PROTOCOL_VERSION;
+    hello.real_size = sizeof(real);
+    hello.real_digits = std::numeric_limits<real>::digits;
+    hello.coordinates = manifold_coordinates(args.manifold, args.dimension);
+    hello.lorentz = is_lorentz(args.manifold);
+    hello.node_count = node_count;
+    hello.shard_count = shard_count;
+    hello.worker_count = args.workers;
+    hello.worker_id = args.worker_id;
+    return hello;
+}
+
+/**
+ * Raise a runtime_error describing the first difference between the Hellos.
+ */
+static void check_hello(const Hello& ours, const Hello& theirs) {
+    std::string problem;
+    if (theirs.magic != PROTOCOL_MAGIC || theirs.version != PROTOCOL_VERSION) {
+        problem = "a different protocol version or byte order";
+    } else if (theirs.real_size != ours.real_size || theirs.real_digits != ours.real_digits) {
+        problem = "a different floating point format";
+    } else if (theirs.lorentz != ours.lorentz) {
+        problem = "a different -manifold";
+    } else if (theirs.coordinates != ours.coordinates) {
+        problem = "a different -dimension";
+    } else if (theirs.node_count != ours.node_count) {
+        problem = "a different graph";
+    } else if (theirs.shard_count != ours.shard_count) {
+        problem = "a different number of -endpoints";
+    } else if (theirs.worker_count != ours.worker_count) {
+        problem = "a different -workers";
+    }
+    if (!problem.empty()) {
+        throw std::runtime_error("peer uses " + problem);
+    }
+}
+
+/**
+ * A connected stream socket, closed on destruction.
+ */
+class Connection {
+    protected:
+        int fd_;
+
+    public:
+        explicit Connection(int fd) : fd_(fd) {}
+        ~Connection() { close(fd_); }
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        void send_all(const void* data, size_t size) {
+            const char* p = static_cast<const char*>(data);
+            while (size > 0) {
+                ssize_t sent = send(fd_, p, size, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("send failed: ") + strerror(errno));
+                }
+                p += sent;
+                size -= sent;
+            }
+        }
+
+        /**
+         * Receive exactly `size` bytes.  Return false if the peer closed the
+         * connection before sending any of them.
+         */
+        bool recv_all(void* data, size_t size) {
+            char* p = static_cast<char*>(data);
+            size_t received_total = 0;
+            while (received_total < size) {
+                ssize_t received = recv(fd_, p + received_total, size - received_total, 0);
+                if (received < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("recv failed: ") + strerror(errno));
+                }
+                if (received == 0) {
+                    if (received_total == 0) {
+                        return false;
+                    }
+                    throw std::runtime_error("connection closed mid-message");
+                }
+                received_total += received;
+            }
+            return true;
+        }
+
+        /**
+         * Send a message consisting of a header and the given body parts as a
+         * single write.
+         */
+        void send_message(uint32_t type, uint32_t count, const std::vector<std::pair<const void*, size_t>>& parts) {
+            MessageHeader header = {type, count};
+            size_t size = sizeof(header);
+            for (auto part = parts.begin(); part != parts.end(); ++part) {
+                size += part->second;
+            }
+            buffer_.resize(size);
+            char* p = buffer_.data();
+            memcpy(p, &header, sizeof(header));
+            p += sizeof(header);
+            for (auto part = parts.begin(); part != parts.end(); ++part) {
+                memcpy(p, part->first, part->second);
+                p += part->second;
+            }
+            send_all(buffer_.data(), size);
+        }
+
+    private:
+        std::vector<char> buffer_;
+};
+
+static std::vector<std::string> split_endpoints(const std::string& endpoints) {
+    std::vector<std::string> result;
+    std::stringstream stream(endpoints);
+    std::string endpoint;
+    while (std::getline(stream, endpoint, ',')) {
+        if (!endpoint.empty()) {
+            result.push_back(endpoint);
+        }
+    }
+    return result;
+}
+
+static bool is_unix_endpoint(const std::string& endpoint) {
+    return endpoint.find('/') != std::string::npos;
+}
+
+static sockaddr_un unix_address(const std::string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("socket path too long: " + path);
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+/**
+ * Resolve a host:port endpoint, returning the list of candidate addresses
+ * (to be freed with freeaddrinfo).
+ */
+static addrinfo* resolve_tcp(const std::string& endpoint, bool passive) {
+    size_t colon = endpoint.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::invalid_argument("endpoint is neither host:port nor a socket path: " + endpoint);
+    }
+    std::string host = endpoint.substr(0, colon);
+    std::string port = endpoint.substr(colon + 1);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* result;
+    int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (status != 0) {
+        throw std::invalid_argument("cannot resolve " + endpoint + ": " + gai_strerror(status));
+    }
+    return result;
+}
+
+static int listen_on(const std::string& endpoint) {
+    int fd = -1;
+    if (is_unix_endpoint(endpoint)) {
+        sockaddr_un address = unix_address(endpoint);
+        unlink(endpoint.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            throw std::runtime_error("cannot bind " + endpoint + ": " + strerror(errno));
+        }
+    } else {
+        addrinfo* candidates = resolve_tcp(endpoint, true);
+        for (addrinfo* a = candidates; a != nullptr; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, a->ai_addr, a->ai_addrlen) == 0) {
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(candidates);
+        if (fd < 0) {
+            throw std::runtime_error("cannot bind " + endpoint);
+        }
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        throw std::runtime_error("cannot listen on " + endpoint + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+static int try_connect(const std::string& endpoint) {
+    if (is_unix_endpoint(endpoint)) {
+        sockaddr_un address = unix_address(endpoint);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+        return -1;
+    }
+    addrinfo* candidates = resolve_tcp(endpoint, false);
+    int fd = -1;
+    for (addrinfo* a = candidates; a != nullptr; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(candidates);
+    return fd;
+}
+
+/**
+ * Connect to the endpoint, retrying while the server starts up.
+ */
+static std::unique_ptr<Connection> connect_to(const std::string& endpoint) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+    while (true) {
+        int fd = try_connect(endpoint);
+        if (fd >= 0) {
+            return std::unique_ptr<Connection>(new Connection(fd));
+        }
+        if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error("cannot connect to " + endpoint);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_MS));
+    }
+}
+
+/**
+ * Holds one shard of the vectors and answers the requests of the workers,
+ * one thread per connection.
+ */
+class ParameterServer {
+    protected:
+        std::shared_ptr<Args> args_;
+        const int32_t shard_;
+        const int32_t shard_count_;
+        const int64_t node_count_;
+        std::vector<Vector> rows_;
+        int listen_fd_;
+
+        // the workers that have connected, and of those the ones that have
+        // finished and the ones whose connection closed before they finished
+        std::mutex finished_mutex_;
+        std::condition_variable finished_cv_;
+        std::set<int32_t> connected_workers_;
+        std::set<int32_t> finished_workers_;
+        std::set<int32_t> lost_workers_;
+
+        Vector& row(int32_t enumeration) {
+            if (enumeration < 0 || enumeration % shard_count_ != shard_) {
+                throw std::runtime_error("request for a row not in this shard: " + std::to_string(enumeration));
+            }
+            return rows_.at(enumeration / shard_count_);
+        }
+
+        void mark_connected(int32_t worker_id) {
+            if (worker_id < 0 || worker_id >= args_->workers) {
+                throw std::runtime_error("no such worker: " + std::to_string(worker_id));
+            }
+            std::lock_guard<std::mutex> lock(finished_mutex_);
+            if (!connected_workers_.insert(worker_id).second) {
+                throw std::runtime_error("worker " + std::to_string(worker_id) + " is already connected");
+            }
+        }
+
+        void mark_finished(int32_t worker_id) {
+            std::lock_guard<std::mutex> lock(finished_mutex_);
+            finished_workers_.insert(worker_id);
+            finished_cv_.notify_all();
+        }
+
+        void mark_lost(int32_t worker_id) {
+            std::lock_guard<std::mutex> lock(finished_mutex_);
+            lost_workers_.insert(worker_id);
+            finished_cv_.notify_all();
+        }
+
+        /**
+         * Handle the requests on the connection until it is closed, setting
+         * `worker_id` once the hello of the worker is accepted and `finished`
+         * once the worker reports it has finished.  Return true if told to
+         * shut down.
+         */
+        bool serve(Connection& connection, int32_t& worker_id, bool& finished) {
+            const int64_t dimension = manifold_coordinates(args_->manifold, args_->dimension);
+            const bool lorentz = is_lorentz(args_->manifold);
+            std::vector<int32_t> ids;
+            std::vector<real> data;
+            Vector delta(dimension);
+            MessageHeader header;
+            // reply with our own Hello before checking, so the worker can
+            // report the mismatch too
+            Hello ours = make_hello(*args_, node_count_, shard_count_);
+            Hello theirs;
+            if (!connection.recv_all(&header, sizeof(header))) {
+                return false;
+            }
+            if (header.type != HELLO || !connection.recv_all(&theirs, sizeof(theirs))) {
+                throw std::runtime_error("expected a hello from the worker");
+            }
+            connection.send_all(&ours, sizeof(ours));
+            check_hello(ours, theirs);
+            mark_connected(theirs.worker_id);
+            worker_id = theirs.worker_id;
+            while (connection.recv_all(&header, sizeof(header))) {
+                if (header.type == PULL) {
+                    ids.resize(header.count);
+                    connection.recv_all(ids.data(), ids.size() * sizeof(int32_t));
+                    data.resize(ids.size() * dimension);
+                    for (size_t k = 0; k < ids.size(); k++) {
+                        const Vector& r = row(ids[k]);
+                        std::copy(r.data_, r.data_ + dimension, data.begin() + k * dimension);
+                    }
+                    connection.send_all(data.data(), data.size() * sizeof(real));
+                } else if (header.type == PUSH) {
+                    ids.resize(header.count);
+                    data.resize(ids.size() * dimension);
+                    connection.recv_all(ids.data(), ids.size() * sizeof(int32_t));
+                    connection.recv_all(data.data(), data.size() * sizeof(real));
+                    for (size_t k = 0; k < ids.size(); k++) {
+                        std::copy(data.begin() + k * dimension, data.begin() + (k + 1) * dimension, delta.data_);
+                        if (lorentz) {
+                            Lorentz::add_change(row(ids[k]), delta);
+                        } else {
+                            PoincareBall::add_change(row(ids[k]), delta);
+                        }
+                    }
+                } else if (header.type == FINISHED) {
+                    finished = true;
+                    mark_finished(worker_id);
+                } else if (header.type == WAIT) {
+                    std::unique_lock<std::mutex> lock(finished_mutex_);
+                    finished_cv_.wait(lock, [this]() {
+                        return finished_workers_.size() + lost_workers_.size() >= args_->workers;
+                    });
+                    uint32_t lost = lost_workers_.size();
+                    lock.unlock();
+                    connection.send_all(&lost, sizeof(lost));
+                } else if (header.type == SHUTDOWN) {
+                    return true;
+                } else {
+                    throw std::runtime_error("unknown message type " + std::to_string(header.type));
+                }
+            }
+            return false;
+        }
+
+    public:
+        ParameterServer(std::shared_ptr<Args> args, const Digraph& digraph, int32_t shard_count) :
+            args_(args), shard_(args->shard), shard_count_(shard_count),
+            node_count_(digraph.enumeration2node.size()), listen_fd_(-1) {
+            std::vector<Vector> all = *Poincare::initial_vectors(*args, digraph);
+            for (int64_t i = shard_; i < all.size(); i += shard_count_) {
+                rows_.push_back(all[i]);
+            }
+        }
+
+        void run(const std::string& endpoint) {
+            listen_fd_ = listen_on(endpoint);
+            std::vector<std::thread> handlers;
+            while (true) {
+                int fd = accept(listen_fd_, nullptr, nullptr);
+                if (fd < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break; // the listening socket was shut down
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                handlers.push_back(std::thread([this, fd]() {
+                    Connection connection(fd);
+                    int32_t worker_id = -1;
+                    bool finished = false;
+                    try {
+                        if (serve(connection, worker_id, finished)) {
+                            shutdown(listen_fd_, SHUT_RDWR);
+                        }
+                    } catch (const std::exception& e) {
+                        std::cerr << "shard " << shard_ << ": " << e.what() << std::endl;
+                    }
+                    if (worker_id >= 0 && !finished) {
+                        // the worker went away without finishing: don't let
+                        // worker 0 wait for it forever, nor report success
+                        std::cerr << "shard " << shard_ << ": lost worker " << worker_id << std::endl;
+                        mark_lost(worker_id);
+                    }
+                }));
+            }
+            for (auto it = handlers.begin(); it != handlers.end(); ++it) {
+                it->join();
+            }
+            close(listen_fd_);
+            if (is_unix_endpoint(endpoint)) {
+                unlink(endpoint.c_str());
+            }
+        }
+};
+
+void run_server(std::shared_ptr<Args> args) {
+    std::vector<std::string> endpoints = split_endpoints(args->endpoints);
+    if (args->shard < 0 || args->shard >= endpoints.size()) {
+        throw std::invalid_argument("-shard must index into -endpoints");
+    }
+    std::shared_ptr<Digraph> digraph = Poincare::load_digraph(args->graph);
+    ParameterServer server(args, *digraph, endpoints.size());
+    server.run(endpoints[args->shard]);
+}
+
+/**
+ * Trains on a partition of the edges against the parameter servers, keeping
+ * local copies of the rows it has pulled in the vectors of its Poincare base.
+ */
+class Worker : public Poincare {
+    protected:
+        /**
+         * The edges of one batch, their samples and the rows they touch.
+         */
+        struct Batch {
+            int64_t first;
+            int32_t edge_count;
+            std::vector<std::vector<int32_t>> samples;
+            std::vector<int32_t> touched;
+        };
+
+        std::vector<std::unique_ptr<Connection>> servers_;
+        // the batch during which each row was last pulled (-1 if never)
+        std::vector<int64_t> pulled_at_;
+        // the batch during which each row was last touched, for deduplication
+        std::vector<int64_t> touched_at_;
+        // whether each row is touched by the batch being trained
+        std::vector<char> in_current_batch_;
+        int64_t batch_index_;
+
+        // per-batch scratch space
+        std::vector<real> before_;
+        std::vector<std::vector<int32_t>> pull_ids_;
+        std::vector<std::vector<real>> pull_data_;
+        std::vector<std::vector<int32_t>> push_ids_;
+        std::vector<std::vector<real>> push_data_;
+        // receives the replies to the pulls of the next batch
+        std::thread receiver_;
+        std::exception_ptr receive_error_;
+
+        int32_t shard_of(int32_t enumeration) const {
+            return enumeration % servers_.size();
+        }
+
+        void touch(Batch& batch, int64_t index, int32_t enumeration) {
+            if (touched_at_[enumeration] != index) {
+                touched_at_[enumeration] = index;
+                batch.touched.push_back(enumeration);
+            }
+        }
+
+        bool is_stale(int32_t enumeration, int64_t index) const {
+            return pulled_at_[enumeration] < 0 || index - pulled_at_[enumeration] > args_->staleness;
+        }
+
+        /**
+         * Fill the batch (the `index`th) with the edges of this worker from
+         * index `first` on, drawing their samples.
+         */
+        void collect(Batch& batch, int64_t first, int64_t index, std::shared_ptr<Args> phase, std::minstd_rand& rng) {
+            const int64_t edge_count = digraph->edges.size();
+            const int64_t stride = args_->workers;
+            batch.first = first;
+            batch.edge_count = 0;
+            batch.samples.resize(args_->batch_size);
+            batch.touched.clear();
+            for (int64_t i = first; i < edge_count && batch.edge_count < args_->batch_size; i += stride) {
+                const Edge& edge = *(digraph->edges)[i];
+                std::vector<int32_t>& samples = batch.samples[batch.edge_count];
+                draw_samples(edge, phase->number_negatives, samples, rng);
+                touch(batch, index, edge.source.enumeration);
+                for (auto sample = samples.begin(); sample != samples.end(); ++sample) {
+                    touch(batch, index, *sample);
+                }
+                batch.edge_count++;
+            }
+        }
+
+        /**
+         * Request the given rows, with one request per server; the replies
+         * are awaited by receive_pull.
+         */
+        void send_pull(const std::vector<int32_t>& ids) {
+            for (size_t s = 0; s < servers_.size(); s++) {
+                pull_ids_[s].clear();
+            }
+            for (auto id = ids.begin(); id != ids.end(); ++id) {
+                pull_ids_[shard_of(*id)].push_back(*id);
+            }
+            for (size_t s = 0; s < servers_.size(); s++) {
+                if (!pull_ids_[s].empty()) {
+                    servers_[s]->send_message(PULL, pull_ids_[s].size(),
+                            {{pull_ids_[s].data(), pull_ids_[s].size() * sizeof(int32_t)}});
+                }
+            }
+        }
+
+        /**
+         * Receive the rows requested by the last send_pull into the local
+         * vectors, recording them as pulled for the `index`th batch.
+         */
+        void receive_pull(int64_t index) {
+            const int64_t dimension = manifold_coordinates(args_->manifold, args_->dimension);
+            for (size_t s = 0; s < servers_.size(); s++) {
+                std::vector<real>& data = pull_data_[s];
+                data.resize(pull_ids_[s].size() * dimension);
+                if (!pull_ids_[s].empty() && !servers_[s]->recv_all(data.data(), data.size() * sizeof(real))) {
+                    throw std::runtime_error("server closed the connection");
+                }
+                for (size_t k = 0; k < pull_ids_[s].size(); k++) {
+                    Vector& local = (*vectors_)[pull_ids_[s][k]];
+                    std::copy(data.begin() + k * dimension, data.begin() + (k + 1) * dimension, local.data_);
+                    pulled_at_[pull_ids_[s][k]] = index;
+                }
+                pull_ids_[s].clear();
+            }
+        }
+
+        /**
+         * Like receive_pull, but on a separate thread, awaited (and any
+         * exception rethrown) by finish_receive_pull.  A server writes the
+         * whole reply to a pull before reading its next message, so the
+         * reply must be drained while the following push is sent, lest both
+         * block writing once it exceeds the socket buffers.  The rows
+         * received must not be touched by this thread until then.
+         */
+        void start_receive_pull(int64_t index) {
+            receive_error_ = nullptr;
+            receiver_ = std::thread([this, index]() {
+                try {
+                    receive_pull(index);
+                } catch (...) {
+                    receive_error_ = std::current_exception();
+                }
+            });
+        }
+
+        void finish_receive_pull() {
+            receiver_.join();
+            if (receive_error_) {
+                std::rethrow_exception(receive_error_);
+            }
+        }
+
+        /**
+         * Push the change in each row touched by the batch since `before_`
+         * was taken.
+         */
+        void push(const Batch& batch) {
+            const int64_t dimension = manifold_coordinates(args_->manifold, args_->dimension);
+            for (size_t s = 0; s < servers_.size(); s++) {
+                push_ids_[s].clear();
+                push_data_[s].clear();
+            }
+            for (size_t k = 0; k < batch.touched.size(); k++) {
+                int32_t id = batch.touched[k];
+                int32_t s = shard_of(id);
+                const Vector& local = (*vectors_)[id];
+                push_ids_[s].push_back(id);
+                for (int64_t j = 0; j < dimension; j++) {
+                    push_data_[s].push_back(local[j] - before_[k * dimension + j]);
+                }
+            }
+            for (size_t s = 0; s < servers_.size(); s++) {
+                if (!push_ids_[s].empty()) {
+                    servers_[s]->send_message(PUSH, push_ids_[s].size(),
+                            {{push_ids_[s].data(), push_ids_[s].size() * sizeof(int32_t)},
+                             {push_data_[s].data(), push_data_[s].size() * sizeof(real)}});
+                }
+            }
+        }
+
+        /**
+         * Train on this worker's edges for an epoch.  The rows of the next
+         * batch that are stale are requested before training the current
+         * one, and received on another thread, so that their transfer
+         * overlaps with the computation and the push; only
+         * those also touched by the current batch are pulled after it (once
+         * its changes have been pushed, so that the pulled rows include them).
+         */
+        template <class Manifold>
+        void train_epoch(std::shared_ptr<Args> phase, uint32_t seed, real start_lr, real end_lr) {
+            std::minstd_rand rng(1 + seed); // seed 0 and 1 coincide for minstd_rand
+            Model<Manifold> model(vectors_, phase);
+            const int64_t edge_count = digraph->edges.size();
+            const int64_t stride = args_->workers;
+            const int64_t edges_per_worker = std::max<int64_t>(edge_count / stride, 1);
+            const int64_t dimension = manifold_coordinates(args_->manifold, args_->dimension);
+            Batch current, next;
+            std::vector<int32_t> prefetch, deferred;
+            int64_t iter_count = 0;
+            clock_t start = clock();
+            real lr = start_lr;
+            real progress = 0.;
+
+            // the first batch has nothing to overlap with
+            collect(current, args_->worker_id, batch_index_, phase, rng);
+            for (auto id = current.touched.begin(); id != current.touched.end(); ++id) {
+                if (is_stale(*id, batch_index_)) {
+                    prefetch.push_back(*id);
+                }
+            }
+            send_pull(prefetch);
+            receive_pull(batch_index_);
+            while (current.edge_count > 0) {
+                // request the stale rows of the next batch that this one
+                // leaves alone
+                for (auto id = current.touched.begin(); id != current.touched.end(); ++id) {
+                    in_current_batch_[*id] = 1;
+                }
+                collect(next, current.first + stride * args_->batch_size, batch_index_ + 1, phase, rng);
+                prefetch.clear();
+                deferred.clear();
+                for (auto id = next.touched.begin(); id != next.touched.end(); ++id) {
+                    if (is_stale(*id, batch_index_ + 1)) {
+                        (in_current_batch_[*id] ? deferred : prefetch).push_back(*id);
+                    }
+                }
+                for (auto id = current.touched.begin(); id != current.touched.end(); ++id) {
+                    in_current_batch_[*id] = 0;
+                }
+                send_pull(prefetch);
+                start_receive_pull(batch_index_ + 1);
+
+                // train on the local copies
+                before_.resize(current.touched.size() * dimension);
+                for (size_t k = 0; k < current.touched.size(); k++) {
+                    const Vector& local = (*vectors_)[current.touched[k]];
+                    std::copy(local.data_, local.data_ + dimension, before_.begin() + k * dimension);
+                }
+                int64_t i = current.first;
+                for (int32_t b = 0; b < current.edge_count; b++, i += stride) {
+                    iter_count++;
+                    progress = real(iter_count) / edges_per_worker;
+                    lr = start_lr * (1.0 - progress) + end_lr * progress;
+                    model.nickel_kiela_objective((digraph->edges)[i]->source.enumeration, current.samples[b], lr);
+                }
+                push(current);
+                finish_receive_pull();
+                if (!deferred.empty()) {
+                    send_pull(deferred);
+                    receive_pull(batch_index_ + 1);
+                }
+                batch_index_++;
+                std::swap(current, next);
+                if (verbose_) {
+                    print_info(start, progress, iter_count, lr, model.get_performance());
+                }
+            }
+            if (verbose_) {
+                std::cerr << std::endl;
+            }
+            epoch_objective_sum_ = model.get_total_performance();
+            epoch_objective_count_ = model.get_total_examples();
+        }
+
+    public:
+        Worker(std::shared_ptr<Args> args) : Poincare(std::make_shared<Args>(*args)), batch_index_(0) {
+            // each worker process trains on a single thread
+            args_->threads = 1;
+            // only the first worker reports progress
+            verbose_ = (args->worker_id == 0);
+        }
+
+        ~Worker() {
+            if (receiver_.joinable()) {
+                receiver_.join();
+            }
+        }
+
+        void run() {
+            try {
+                train_all();
+            } catch (...) {
+                if (args_->worker_id == 0) {
+                    // no other worker will shut the servers down
+                    shutdown_servers();
+                }
+                throw;
+            }
+        }
+
+        void train_all() {
+            std::vector<std::string> endpoints = split_endpoints(args_->endpoints);
+            if (endpoints.empty()) {
+                throw std::invalid_argument("no -endpoints given");
+            }
+            digraph = load_digraph(args_->graph);
+            std::vector<std::shared_ptr<Args>> phases = args_->phases();
+            sampler = build_sampler(*digraph, phases[0]->distribution_power);
+            vectors_ = std::make_shared<std::vector<Vector>>(digraph->node_count(), Vector(manifold_coordinates(args_->manifold, args_->dimension)));
+            pulled_at_.assign(digraph->node_count(), -1);
+            touched_at_.assign(digraph->node_count(), -1);
+            in_current_batch_.assign(digraph->node_count(), 0);
+            Hello ours = make_hello(*args_, digraph->node_count(), endpoints.size());
+            for (auto endpoint = endpoints.begin(); endpoint != endpoints.end(); ++endpoint) {
+                servers_.push_back(connect_to(*endpoint));
+                servers_.back()->send_message(HELLO, 0, {{&ours, sizeof(ours)}});
+                Hello theirs;
+                if (!servers_.back()->recv_all(&theirs, sizeof(theirs))) {
+                    throw std::runtime_error("server closed the connection: " + *endpoint);
+                }
+                check_hello(ours, theirs);
+            }
+            pull_ids_.resize(servers_.size());
+            pull_data_.resize(servers_.size());
+            push_ids_.resize(servers_.size());
+            push_data_.resize(servers_.size());
+
+            int32_t epochs_trained = 0;
+            for (auto phase = phases.begin(); phase != phases.end(); ++phase) {
+                sampler->reweight((*phase)->distribution_power);
+                real lr_delta_per_epoch = ((*phase)->start_lr - (*phase)->end_lr) / (*phase)->epochs;
+                for (int32_t epoch = 0; epoch < (*phase)->epochs; epoch++) {
+                    if (verbose_) {
+                        std::cerr << "\rEpoch: " << (epoch + 1) << " / " << (*phase)->epochs << "\n";
+                    }
+                    real epoch_start_lr = (*phase)->start_lr - real(epoch) * lr_delta_per_epoch;
+                    real epoch_end_lr = (*phase)->start_lr - real(epoch + 1) * lr_delta_per_epoch;
+                    uint32_t seed = args_->seed + (epochs_trained + epoch) * args_->workers + args_->worker_id;
+                    if (is_lorentz(args_->manifold)) {
+                        train_epoch<Lorentz>(*phase, seed, epoch_start_lr, epoch_end_lr);
+                    } else {
+                        train_epoch<PoincareBall>(*phase, seed, epoch_start_lr, epoch_end_lr);
+                    }
+                }
+                epochs_trained += (*phase)->epochs;
+            }
+            for (auto server = servers_.begin(); server != servers_.end(); ++server) {
+                (*server)->send_message(FINISHED, 0, {});
+            }
+            if (args_->worker_id == 0) {
+                collect_and_shutdown();
+            }
+        }
+
+        /**
+         * Wait for all workers to finish, pull every row, write the vectors and
+         * shut down the servers.
+         */
+        void collect_and_shutdown() {
+            for (auto server = servers_.begin(); server != servers_.end(); ++server) {
+                (*server)->send_message(WAIT, 0, {});
+                uint32_t lost;
+                if (!(*server)->recv_all(&lost, sizeof(lost))) {
+                    throw std::runtime_error("server closed the connection");
+                }
+                if (lost > 0) {
+                    throw std::runtime_error(std::to_string(lost) + " workers were lost before finishing, "
+                                             + "so their edges were not all trained");
+                }
+            }
+            std::vector<int32_t> all(digraph->node_count());
+            for (int32_t i = 0; i < all.size(); i++) {
+                all[i] = i;
+            }
+            send_pull(all);
+            receive_pull(batch_index_);
+            save_vectors(args_->output_vectors);
+            shutdown_servers();
+        }
+
+        /**
+         * Tell every connected server to shut down, ignoring any that can no
+         * longer be reached.
+         */
+        void shutdown_servers() {
+            for (auto server = servers_.begin(); server != servers_.end(); ++server) {
+                try {
+                    (*server)->send_message(SHUTDOWN, 0, {});
+                } catch (const std::exception&) {
+                    // already gone
+                }
+            }
+        }
+};
+
+void run_worker(std::shared_ptr<Args> args) {
+    if (args->worker_id < 0 || args->worker_id >= args->workers) {
+        throw std::invalid_argument("-worker-id must be less than -workers");
+    }
+    Worker worker(args);
+    worker.run();
+}
+
+int run_local_cluster(std::shared_ptr<Args> args) {
+    std::string socket_dir;
+    if (args->endpoints.empty()) {
+        char dir_template[] = "/tmp/poincare-XXXXXX";
+        if (mkdtemp(dir_template) == nullptr) {
+            throw std::runtime_error(std::string("cannot create socket directory: ") + strerror(errno));
+        }
+        socket_dir = dir_template;
+        for (int32_t s = 0; s < args->servers; s++) {
+            args->endpoints += (s > 0 ? "," : "") + socket_dir + "/shard-" + std::to_string(s) + ".sock";
+        }
+    }
+    const int32_t server_count = split_endpoints(args->endpoints).size();
+    std::cerr << "Starting " << server_count << " servers and " << args->workers << " workers\n";
+    std::vector<pid_t> children;
+    for (int32_t p = 0; p < server_count + args->workers; p++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error(std::string("fork failed: ") + strerror(errno));
+        }
+        if (pid == 0) {
+            std::shared_ptr<Args> child_args = std::make_shared<Args>(*args);
+            try {
+                if (p < server_count) {
+                    child_args->shard = p;
+                    run_server(child_args);
+                } else {
+                    child_args->worker_id = p - server_count;
+                    run_worker(child_args);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                _exit(EXIT_FAILURE);
+            }
+            _exit(EXIT_SUCCESS);
+        }
+        children.push_back(pid);
+    }
+    int failures = 0;
+    while (!children.empty()) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        auto child = std::find(children.begin(), children.end(), pid);
+        if (child == children.end()) {
+            continue;
+        }
+        children.erase(child);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            if (failures == 0) {
+                // the others may be waiting on the failed process forever
+                for (auto other = children.begin(); other != children.end(); ++other) {
+                    kill(*other, SIGTERM);
+                }
+            }
+            failures++;
+        }
+    }
+    if (!socket_dir.empty()) {
+        // servers that were killed leave their sockets behind
+        std::vector<std::string> endpoints = split_endpoints(args->endpoints);
+        for (auto endpoint = endpoints.begin(); endpoint != endpoints.end(); ++endpoint) {
+            unlink(endpoint->c_str());
+        }
+        rmdir(socket_dir.c_str());
+    }
+    return failures;
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+
+#include "args.h"
+
+namespace poincare {
+
+/**
+ * Data-parallel training over sockets, with the vectors sharded by node
+ * enumeration across parameter server processes: server `s` of `S` owns the
+ * vectors of the nodes whose enumeration is congruent to s modulo S.
+ *
+ * Every process reads the graph itself, so that all agree on the
+ * enumeration.  Worker `w` of `W` trains on the edges whose index is
+ * congruent to w modulo W, in batches of args->batch_size edges: it pulls the
+ * rows a batch touches that are not in its local cache (or were pulled more
+ * than args->staleness batches ago), requesting them while the previous
+ * batch trains where possible, trains on its local copies, and then
+ * pushes the change of each touched row to its server without waiting for a
+ * reply.  Servers add the pushed changes (pulling back inside the ball) as
+ * they arrive, Hogwild-style.
+ *
+ * Every connection starts with a hello exchange of the protocol version, the
+ * floating point format, the manifold, the number of coordinates per row, the
+ * graph and shard sizes and the number of workers; either side fails on a
+ * mismatch, since rows are sent as raw reals in host byte order.  The hello
+ * of a worker also gives its id, so that servers can tell which workers have
+ * finished: a worker whose connection closes before it finishes is lost, and
+ * worker 0 then fails rather than write vectors missing its updates.
+ *
+ * Endpoints are given by args->endpoints as a comma-separated list, one per
+ * server, each either host:port (TCP) or a path containing a '/' (a Unix
+ * domain socket).
+ */
+
+/**
+ * Serve shard args->shard of the vectors at the corresponding endpoint until
+ * told to shut down by worker 0.
+ */
+void run_server(std::shared_ptr<Args> args);
+
+/**
+ * Train as worker args->worker_id.  When done, worker 0 waits for all
+ * workers to finish, writes the vectors to args->output_vectors and shuts
+ * down the servers (which it also does if it fails, including when another
+ * worker was lost).
+ */
+void run_worker(std::shared_ptr<Args> args);
+
+/**
+ * Run args->servers servers and args->workers workers as child processes on
+ * this machine, communicating over Unix domain sockets in a temporary
+ * directory (unless args->endpoints is given), and wait for them to finish.
+ * If any child fails, the others are terminated.
+ * Return the number of child processes that failed.
+ */
+int run_local_cluster(std::shared_ptr<Args> args);
+
+}
@@ -0,0 +1,365 @@
+#include "io.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+namespace poincare {
+
+// how many lines each thread formats before the buffers are written out
+constexpr int64_t LINES_PER_BLOCK = 16384;
+// significant decimal digits that always fit exactly in a uint64_t
+constexpr int32_t MAX_FAST_DIGITS = 19;
+// powers of ten that are exactly representable as a long double
+static const real POWERS_OF_TEN[] = {
+    1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+    1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+    1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L};
+constexpr int32_t MAX_EXACT_POWER = 27;
+// identifies (the version of) the snapshot format
+static const char STATE_MAGIC[8] = {'P', 'O', 'I', 'N', 'S', 'T', '0', '3'};
+constexpr size_t MAX_MANIFOLD_NAME = 16;
+// bounds the schedule read from a (possibly corrupt) snapshot
+constexpr int64_t MAX_SCHEDULE_LENGTH = 1 << 20;
+
+struct StateHeader {
+    char magic[8];
+    char manifold[MAX_MANIFOLD_NAME]; // zero-padded
+    int32_t real_size;
+    int32_t epochs_trained;
+    int32_t seed;
+    int32_t threads;
+    int64_t vector_count;
+    int64_t dimension;
+    int64_t schedule_length; // followed by the schedule, then the vectors
+};
+
+/**
+ * Run `work(thread_id)` on `threads` threads, rethrowing the first exception
+ * raised by any of them once all have finished.
+ */
+template <typename Work>
+static void run_in_parallel(int threads, Work work) {
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(threads);
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&, t]() {
+            try {
+                work(t);
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        }));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+    for (auto it = errors.begin(); it != errors.end(); ++it) {
+        if (*it) {
+            std::rethrow_exception(*it);
+        }
+    }
+}
+
+static void format_line(std::string& out, const std::string& name, const Vector& v, int precision) {
+    char buf[64];
+    out += name;
+    for (int64_t j = 0; j < v.size(); j++) {
+        int len = snprintf(buf, sizeof(buf), " %.*Lg", precision, v[j]);
+        if (len < sizeof(buf)) {
+            out.append(buf, len);
+        } else {
+            // too long for the stack buffer: format straight into the output
+            size_t offset = out.size();
+            out.resize(offset + len + 1);
+            snprintf(&out[offset], len + 1, " %.*Lg", precision, v[j]);
+            out.resize(offset + len);
+        }
+    }
+    out += '\n';
+}
+
+void write_vectors(const std::string& fn, const Digraph& digraph,
+                   const std::vector<Vector>& vectors, int precision, int threads) {
+    std::ofstream ofs(fn, std::ios::binary);
+    if (!ofs.is_open()) {
+        throw std::invalid_argument(fn + " cannot be opened!");
+    }
+    threads = std::max(threads, 1);
+    const int64_t line_count = digraph.enumeration2node.size();
+    std::vector<std::string> buffers(threads);
+    for (int64_t block_start = 0; block_start < line_count; block_start += threads * LINES_PER_BLOCK) {
+        run_in_parallel(threads, [&](int t) {
+            std::string& buffer = buffers[t];
+            buffer.clear();
+            int64_t begin = std::min(block_start + t * LINES_PER_BLOCK, line_count);
+            int64_t end = std::min(begin + LINES_PER_BLOCK, line_count);
+            for (int64_t i = begin; i < end; i++) {
+                format_line(buffer, digraph.enumeration2node[i]->name, vectors[i], precision);
+            }
+        });
+        for (int t = 0; t < threads; t++) {
+            ofs.write(buffers[t].data(), buffers[t].size());
+        }
+    }
+    ofs.close();
+    if (ofs.fail()) {
+        throw std::runtime_error("failed writing " + fn);
+    }
+}
+
+bool parse_real(const char* begin, const char* end, real& value) {
+    const char* p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int32_t significant_digits = 0;
+    int32_t exponent = 0;
+    bool any_digits = false;
+    bool fast = true;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any_digits = true;
+        if (mantissa == 0 && *p == '0') {
+            continue;
+        }
+        if (significant_digits == MAX_FAST_DIGITS) {
+            fast = false;
+            break;
+        }
+        mantissa = 10 * mantissa + (*p - '0');
+        significant_digits++;
+    }
+    if (fast && p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any_digits = true;
+            exponent--;
+            if (mantissa == 0 && *p == '0') {
+                continue;
+            }
+            if (significant_digits == MAX_FAST_DIGITS) {
+                fast = false;
+                break;
+            }
+            mantissa = 10 * mantissa + (*p - '0');
+            significant_digits++;
+        }
+    }
+    if (fast && any_digits && p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative_exponent = (*p == '-');
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+        int32_t e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            e = std::min(10 * e + (*p - '0'), 100000);
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+    if (fast && any_digits && p == end && !(mantissa == 0 && negative)) {
+        // a single (correctly rounded) operation on exact operands
+        if (exponent >= 0 && exponent <= MAX_EXACT_POWER) {
+            value = real(mantissa) * POWERS_OF_TEN[exponent];
+            value = negative ? -value : value;
+            return true;
+        } else if (exponent < 0 && -exponent <= MAX_EXACT_POWER) {
+            value = real(mantissa) / POWERS_OF_TEN[-exponent];
+            value = negative ? -value : value;
+            return true;
+        }
+    }
+    // fall back to the library for anything unusual
+    std::string token(begin, end);
+    char* parsed_end;
+    value = strtold(token.c_str(), &parsed_end);
+    return !token.empty() && parsed_end == token.c_str() + token.size();
+}
+
+/**
+ * Parse the lines in [begin, end) into `vectors`.
+ */
+static void parse_lines(const char* begin, const char* end, const Digraph& digraph,
+                        std::vector<Vector>& vectors) {
+    const char* p = begin;
+    while (p < end) {
+        const char* line_end = std::find(p, end, '\n');
+        const char* content_end = line_end;
+        if (content_end > p && *(content_end - 1) == '\r') {
+            content_end--;
+        }
+        if (p < content_end) {
+            const char* name_end = std::find(p, content_end, ' ');
+            Vector& vector = vectors.at(digraph.name2node.at(std::string(p, name_end))->enumeration);
+            int64_t col = 0;
+            const char* field = name_end;
+            while (field < content_end) {
+                field++; // skip the separator
+                const char* field_end = std::find(field, content_end, ' ');
+                if (col >= vector.size()) {
+                    throw std::runtime_error("too many components in line: " + std::string(p, content_end));
+                }
+                if (!parse_real(field, field_end, vector[col])) {
+                    throw std::runtime_error("cannot parse component: " + std::string(field, field_end));
+                }
+                col++;
+                field = field_end;
+            }
+        }
+        p = line_end + 1;
+    }
+}
+
+void read_vectors(const std::string& fn, const Digraph& digraph,
+                  std::vector<Vector>& vectors, int threads) {
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::invalid_argument(fn + " cannot be opened!");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::invalid_argument(fn + " cannot be opened!");
+    }
+    const size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::invalid_argument(fn + " cannot be mapped!");
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    const char* data = static_cast<const char*>(mapped);
+    const char* data_end = data + size;
+
+    // split into chunks of roughly equal size, each ending at a line boundary
+    threads = std::max(threads, 1);
+    std::vector<const char*> boundaries(threads + 1, data_end);
+    boundaries[0] = data;
+    for (int t = 1; t < threads; t++) {
+        const char* guess = std::max(data + size * t / threads, boundaries[t - 1]);
+        const char* newline = std::find(guess, data_end, '\n');
+        boundaries[t] = (newline == data_end) ? data_end : newline + 1;
+    }
+    try {
+        run_in_parallel(threads, [&](int t) {
+            parse_lines(boundaries[t], boundaries[t + 1], digraph, vectors);
+        });
+    } catch (...) {
+        munmap(mapped, size);
+        throw;
+    }
+    munmap(mapped, size);
+}
+
+void write_state(const std::string& fn, const TrainingState& state, const std::vector<Vector>& vectors) {
+    if (state.manifold.size() >= MAX_MANIFOLD_NAME) {
+        throw std::invalid_argument("manifold name too long: " + state.manifold);
+    }
+    StateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    memcpy(header.manifold, state.manifold.data(), state.manifold.size());
+    header.real_size = sizeof(real);
+    header.epochs_trained = state.epochs_trained;
+    header.seed = state.seed;
+    header.threads = state.threads;
+    header.vector_count = vectors.size();
+    header.dimension = vectors.empty() ? 0 : vectors[0].size();
+    header.schedule_length = state.schedule.size();
+
+    std::string tmp_fn = fn + ".tmp";
+    FILE* file = fopen(tmp_fn.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error(tmp_fn + " cannot be opened!");
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(state.schedule.data(), 1, state.schedule.size(), file) == state.schedule.size();
+    for (auto v = vectors.begin(); ok && v != vectors.end(); ++v) {
+        ok = fwrite(v->data_, sizeof(real), v->size(), file) == v->size();
+    }
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmp_fn.c_str(), fn.c_str()) != 0) {
+        unlink(tmp_fn.c_str());
+        throw std::runtime_error("failed writing " + fn);
+    }
+    // sync the directory too, so that the rename itself survives a crash
+    size_t slash = fn.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : fn.substr(0, slash));
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        throw std::runtime_error(dir + " cannot be opened!");
+    }
+    ok = fsync(dir_fd) == 0;
+    close(dir_fd);
+    if (!ok) {
+        throw std::runtime_error("failed syncing " + dir);
+    }
+}
+
+TrainingState read_state(const std::string& fn, const std::string& manifold, std::vector<Vector>& vectors) {
+    FILE* file = fopen(fn.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::invalid_argument(fn + " cannot be opened!");
+    }
+    StateHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) == 0
+        && header.real_size == sizeof(real)
+        && header.schedule_length >= 0 && header.schedule_length <= MAX_SCHEDULE_LENGTH;
+    if (!ok) {
+        fclose(file);
+        throw std::runtime_error(fn + " is not a training snapshot");
+    }
+    std::string stored_manifold(header.manifold, strnlen(header.manifold, MAX_MANIFOLD_NAME));
+    if (stored_manifold != manifold) {
+        fclose(file);
+        throw std::runtime_error(fn + " holds points of the " + stored_manifold + " manifold, expected " + manifold);
+    }
+    const int64_t dimension = vectors.empty() ? 0 : vectors[0].size();
+    if (header.vector_count != vectors.size() || header.dimension != dimension) {
+        fclose(file);
+        throw std::runtime_error(fn + " holds " + std::to_string(header.vector_count) + " vectors of dimension "
+                + std::to_string(header.dimension) + ", expected " + std::to_string(vectors.size())
+                + " of dimension " + std::to_string(dimension));
+    }
+    std::string schedule(header.schedule_length, '\0');
+    ok = fread(&schedule[0], 1, schedule.size(), file) == schedule.size();
+    for (auto v = vectors.begin(); ok && v != vectors.end(); ++v) {
+        ok = fread(v->data_, sizeof(real), v->size(), file) == v->size();
+    }
+    fclose(file);
+    if (!ok) {
+        throw std::runtime_error(fn + " is truncated");
+    }
+    TrainingState state;
+    state.epochs_trained = header.epochs_trained;
+    state.seed = header.seed;
+    state.threads = header.threads;
+    state.manifold = stored_manifold;
+    state.schedule = schedule;
+    return state;
+}
+
+}
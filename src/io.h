@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "digraph.h"
+#include "real.h"
+#include "vector.h"
+
+namespace poincare {
+
+/**
+ * Write the vectors to `fn` as a space-separated CSV without header, one line
+ * per node in enumeration order, the first column being the node name e.g.
+ *   sen.n.01 -0.07573256650403173837 0.04804740830803629381
+ *   ...
+ * Components are formatted as by `std::ostream` at the given precision in the
+ * default floatfield, so the output is byte-identical to streaming the
+ * vectors.  Lines are formatted by `threads` threads into per-thread buffers
+ * which are then written out in order, in large blocks.
+ * Raises an invalid_argument if the file cannot be opened, and a
+ * runtime_error if writing fails.
+ */
+void write_vectors(const std::string& fn, const Digraph& digraph,
+                   const std::vector<Vector>& vectors, int precision, int threads);
+
+/**
+ * Read vectors in the format written by write_vectors from `fn`, overwriting
+ * the vectors of the nodes named in the file.  The file is memory-mapped and
+ * split at line boundaries into `threads` chunks that are parsed in parallel.
+ * Raises an invalid_argument if the file cannot be opened, an out_of_range if
+ * it names a node not in `digraph`, and a runtime_error if it is malformed.
+ */
+void read_vectors(const std::string& fn, const Digraph& digraph,
+                  std::vector<Vector>& vectors, int threads);
+
+/**
+ * The state of a training run at an epoch boundary, besides the vectors.
+ * Nothing more is needed to resume: the random number generators of the
+ * threads are re-seeded from the seed and the epoch count at the start of
+ * every epoch, the learning rates follow from the epoch count and the phases,
+ * and the sampler from the distribution power of the phase (the optimiser is
+ * plain SGD, so has no state of its own).  The seed, thread count and
+ * schedule are recorded so that a resumed run can check it will continue
+ * identically.
+ */
+struct TrainingState {
+    int32_t epochs_trained;
+    int32_t seed;
+    int32_t threads;
+    // the manifold (as named by -manifold) whose coordinates the vectors hold
+    std::string manifold;
+    // the learning rate and sampling schedule, as described by Args::schedule
+    std::string schedule;
+};
+
+/**
+ * Write the training state and vectors to `fn` in binary, atomically: the
+ * data is written and synced to a temporary file that is then renamed to
+ * `fn`, and the directory synced, so that `fn` always holds a complete
+ * snapshot even if the process is killed (or the machine loses power) while
+ * writing.
+ * Raises a runtime_error if writing fails.
+ */
+void write_state(const std::string& fn, const TrainingState& state, const std::vector<Vector>& vectors);
+
+/**
+ * Read a snapshot written by write_state into `vectors`, which hold points
+ * of the named manifold, returning the training state.
+ * Raises an invalid_argument if the file cannot be opened, and a
+ * runtime_error if it is not a snapshot or does not match the manifold and
+ * the number and dimension of `vectors`.
+ */
+TrainingState read_state(const std::string& fn, const std::string& manifold, std::vector<Vector>& vectors);
+
+/**
+ * Parse the decimal floating point number in [begin, end) into `value`,
+ * returning false if the whole range is not a valid number.  Numbers with at
+ * most 19 significant digits and moderate exponents (i.e. everything written
+ * by write_vectors at the default precision) are parsed directly and
+ * correctly rounded; anything else is handed to strtold.
+ */
+bool parse_real(const char* begin, const char* end, real& value);
+
+}
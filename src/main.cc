@@ -1,16 +1,41 @@
 #include <iostream>
 
+#include "distributed.h"
 #include "poincare.h"
+#include "sweep.h"
 #include "args.h"
 
 using namespace poincare;
 
 int main(int argc, char** argv) {
     std::vector<std::string> args(argv, argv + argc);
+    // an optional first argument without a dash selects the mode
+    std::string mode = "train";
+    if (args.size() > 1 && !args[1].empty() && args[1][0] != '-') {
+        mode = args[1];
+        args.erase(args.begin() + 1);
+    }
     std::shared_ptr<Args> a = std::make_shared<Args>();
     a->parse_args(args);
-    Poincare poincare(a);
-    poincare.train();
-    poincare.save_vectors(a->output_vectors);
+    if (mode != "sweep" && !a->sweep_specs.empty()) {
+        std::cerr << "-sweep is only available in sweep mode (poincare sweep ...)" << std::endl;
+        return 1;
+    }
+    if (mode == "sweep") {
+        run_sweep(a);
+    } else if (mode == "server") {
+        run_server(a);
+    } else if (mode == "worker") {
+        run_worker(a);
+    } else if (mode == "cluster") {
+        return run_local_cluster(a) == 0 ? 0 : 1;
+    } else if (mode == "train") {
+        Poincare poincare(a);
+        poincare.train();
+        poincare.save_vectors(a->output_vectors);
+    } else {
+        std::cerr << "Unknown mode: " << mode << " (expected sweep, server, worker or cluster)" << std::endl;
+        return 1;
+    }
     return 0;
 }
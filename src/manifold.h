@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "real.h"
+#include "vector.h"
+
+namespace poincare {
+
+static const real EPS = 1e-5;
+static const real BOUNDARY = 1 - EPS;
+
+inline real clip(real value, real min_, real max_) {
+    if (value < min_) {
+        return min_;
+    } else if (value > max_) {
+        return max_;
+    }
+    return value;
+}
+
+/*
+ * The geometry of the embedding is a compile-time policy: a class with the
+ * static members below, on which Model (and the trainer) is templated.
+ * Points are stored as Vectors of `coordinates(dimension)` components.
+ *
+ *   coordinates(dimension)   number of components stored per point
+ *   point_scalar(x)          a scalar precomputed once per point and passed to
+ *                            arccosh_arg and distance_gradient
+ *   arccosh_arg(x, v, sx, sv)
+ *                            the argument of arccosh in the hyperbolic
+ *                            distance d(x, v), i.e. cosh d(x, v)
+ *   distance_gradient(gradient, x, v, sx, sv, arccosh_arg)
+ *                            the Riemannian gradient of d(x, v) w.r.t. x
+ *   update(point, tangent)   move the point in the direction of the tangent
+ *                            vector (a retraction)
+ *   add_change(point, change)
+ *                            add the difference of two points to a point,
+ *                            returning it to the manifold
+ *   project(point)           return (or initialise) a point to the manifold
+ *   to_ball(x, p), from_ball(p, x)
+ *                            convert to and from the Poincaré ball, in which
+ *                            vectors are read and written
+ */
+
+/**
+ * The Poincaré ball, with updates made by adding the tangent and pulling
+ * back inside the ball (in the manner of Nickel & Kiela).
+ */
+struct PoincareBall {
+    static int64_t coordinates(int64_t dimension) {
+        return dimension;
+    }
+
+    /**
+     * The squared norm, clipped to lie inside the ball.
+     */
+    static real point_scalar(const Vector& x) {
+        return clip(x.squared_norm(), 0, BOUNDARY);
+    }
+
+    static real arccosh_arg(const Vector& x, const Vector& v, real sqnormx, real sqnormv) {
+        return 1 + 2 * squared_dist(x, v) / ((1 - sqnormv) * (1 - sqnormx));
+    }
+
+    /**
+     * Compute the poincare ball gradient of hyperbolic distance d(x, v) w.r.t. x,
+     * given the various pre-computed scalars.
+     */
+    static void distance_gradient(Vector& gradient, const Vector& x, const Vector& v, real sqnormx, real sqnormv, real arccosh_arg) {
+        gradient.zero();
+        real alpha = 1 - sqnormx;
+        real beta = 1 - sqnormv;
+        real a = (sqnormv - 2 * dot(x, v) + 1) / pow(alpha, 2);
+        gradient.add(x, a);
+        gradient.add(v, -1 / alpha);
+        real z = std::max(beta * sqrt(pow(arccosh_arg, 2) - 1), EPS);
+        gradient.multiply(4. / z);
+        // rescale the Euclidean gradient to obtain the Poincaré gradient
+        gradient.multiply(pow(alpha, 2) / 4);
+    }
+
+    /**
+     * Update (in place) the poincare point in the direction of its
+     * (poincare-)tangent vector `tangent`.
+     * Update by adding the tangent vector `tangent` and pulling back inside
+     * the ball, if necessary (in the manner of Nickel & Kiela).
+     */
+    static void update(Vector& point, const Vector& tangent) {
+        point.add(tangent);
+        project(point);
+    }
+
+    static void add_change(Vector& point, const Vector& change) {
+        update(point, change);
+    }
+
+    /**
+     * Pull back inside the ball if necessary.
+     */
+    static void project(Vector& point) {
+        real norm = std::sqrt(dot(point, point));
+        if (norm >= 1) {
+            point.multiply(1. / norm);
+        }
+    }
+
+    static void to_ball(const Vector& x, Vector& p) {
+        std::copy(x.data_, x.data_ + x.size(), p.data_);
+    }
+
+    static void from_ball(const Vector& p, Vector& x) {
+        std::copy(p.data_, p.data_ + p.size(), x.data_);
+    }
+};
+
+/**
+ * The Lorentz (hyperboloid) model: the points x with <x, x> = -1 and x[0] > 0
+ * under the Minkowski inner product <x, v> = -x[0] v[0] + x[1] v[1] + ...
+ * Updates follow the exponential map, so points never need pulling back from
+ * a boundary.
+ */
+struct Lorentz {
+    // bound on the (Minkowski) length of a single step along a geodesic, to
+    // keep cosh and sinh finite when the gradient is very large
+    static constexpr real MAX_STEP = 1;
+
+    static int64_t coordinates(int64_t dimension) {
+        return dimension + 1;
+    }
+
+    static real minkowski_dot(const Vector& x, const Vector& v) {
+        return dot(x, v) - 2 * x[0] * v[0];
+    }
+
+    static real point_scalar(const Vector&) {
+        return 0;
+    }
+
+    static real arccosh_arg(const Vector& x, const Vector& v, real, real) {
+        return std::max(-minkowski_dot(x, v), real(1));
+    }
+
+    /**
+     * The gradient of arccosh(-<x, v>) w.r.t. x is -v / sqrt(arg^2 - 1) after
+     * raising the index with the Minkowski metric; project it onto the tangent
+     * space at x.
+     */
+    static void distance_gradient(Vector& gradient, const Vector& x, const Vector& v, real, real, real arccosh_arg) {
+        gradient.zero();
+        real z = std::max(std::sqrt(arccosh_arg * arccosh_arg - 1), EPS);
+        gradient.add(v, -1 / z);
+        gradient.add(x, minkowski_dot(x, gradient));
+    }
+
+    /**
+     * Move the point along the geodesic in the direction of `tangent`, using
+     * the exponential map.  The tangent is first projected onto the tangent
+     * space at the point, since it may have been computed at an earlier
+     * position of the point (e.g. when updates are deferred).
+     */
+    static void update(Vector& point, const Vector& tangent) {
+        // the projection is tangent + c * point, with squared length
+        // <tangent, tangent> + c^2 as <point, point> = -1
+        real c = minkowski_dot(point, tangent);
+        real norm = std::sqrt(std::max(minkowski_dot(tangent, tangent) + c * c, real(0)));
+        if (norm > 0) {
+            real step = std::min(norm, real(MAX_STEP));
+            point.multiply(cosh(step) + c * sinh(step) / norm);
+            point.add(tangent, sinh(step) / norm);
+        }
+        project(point);
+    }
+
+    static void add_change(Vector& point, const Vector& change) {
+        point.add(change);
+        project(point);
+    }
+
+    /**
+     * Recompute x[0] from the other components, correcting any numerical
+     * drift off the hyperboloid.
+     */
+    static void project(Vector& point) {
+        real sqnorm = 0;
+        for (int64_t i = 1; i < point.size(); i++) {
+            sqnorm += point[i] * point[i];
+        }
+        point[0] = std::sqrt(1 + sqnorm);
+    }
+
+    static void to_ball(const Vector& x, Vector& p) {
+        for (int64_t i = 0; i < p.size(); i++) {
+            p[i] = x[i + 1] / (1 + x[0]);
+        }
+    }
+
+    static void from_ball(const Vector& p, Vector& x) {
+        real sqnorm = clip(p.squared_norm(), 0, BOUNDARY);
+        x[0] = (1 + sqnorm) / (1 - sqnorm);
+        for (int64_t i = 0; i < p.size(); i++) {
+            x[i + 1] = 2 * p[i] / (1 - sqnorm);
+        }
+    }
+};
+
+/**
+ * Return the hyperbolic distance between the points x and v.
+ */
+template <class Manifold>
+real distance(const Vector& x, const Vector& v) {
+    real arg = Manifold::arccosh_arg(x, v, Manifold::point_scalar(x), Manifold::point_scalar(v));
+    return std::acosh(std::max(arg, real(1)));
+}
+
+/**
+ * Whether the manifold named by the -manifold flag is the Lorentz model
+ * (rather than the default Poincaré ball).
+ */
+inline bool is_lorentz(const std::string& manifold) {
+    return manifold == "lorentz";
+}
+
+/**
+ * Return the number of components stored per point of the given dimension on
+ * the named manifold.
+ */
+inline int64_t manifold_coordinates(const std::string& manifold, int64_t dimension) {
+    return is_lorentz(manifold) ? Lorentz::coordinates(dimension) : PoincareBall::coordinates(dimension);
+}
+
+}
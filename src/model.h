@@ -4,35 +4,89 @@
 #include <mutex>
 
 #include "args.h"
+#include "manifold.h"
 #include "vector.h"
 #include "real.h"
 
 namespace poincare {
 
-static const real EPS = 1e-5;
-static const real BOUNDARY = 1 - EPS;
+/**
+ * Row updates recorded by a Model instead of being applied (see
+ * Model::defer_updates).
+ */
+struct PendingUpdates {
+    // the rows updated, bucketed by owner (the row modulo the bucket count)
+    std::vector<std::vector<int32_t>> rows;
+    // the tangent of each update, concatenated in the order of the rows of
+    // the same bucket
+    std::vector<std::vector<real>> tangents;
+
+    explicit PendingUpdates(int32_t owners) : rows(owners), tangents(owners) {}
+
+    void record(int32_t row, const Vector& tangent) {
+        int32_t owner = row % rows.size();
+        rows[owner].push_back(row);
+        tangents[owner].insert(tangents[owner].end(), tangent.data_, tangent.data_ + tangent.size());
+    }
+
+    void clear() {
+        for (size_t owner = 0; owner < rows.size(); owner++) {
+            rows[owner].clear();
+            tangents[owner].clear();
+        }
+    }
+};
 
+/**
+ * The Nickel & Kiela objective, with the geometry given by the `Manifold`
+ * policy (see manifold.h).
+ */
+template <class Manifold>
 class Model {
     protected:
         std::shared_ptr<std::vector<Vector>> vectors_;
         std::shared_ptr<Args> args_;
         real performance_;
         int64_t nexamples_;
+        real total_performance_;
+        int64_t total_examples_;
 
         // these should be locals, but are instance variables to avoid the
         // (appreciable) slow sown resulting from repeated memory allocation
-        std::vector<real> sample_sq_norms;
-        std::vector<real> sample_sq_euc_dists;
+        std::vector<real> sample_scalars;
         std::vector<real> arccosh_args;
         std::vector<real> activations;
         Vector acc_source_gradient;
         Vector tmp_gradient;
 
+        // if not null, where updates are recorded instead of being applied
+        PendingUpdates* pending_;
+
+        /**
+         * Update the vector of `row` by `tangent`, or record the update if
+         * updates are deferred.
+         */
+        void apply_update(int32_t row, const Vector& tangent);
+
     public:
         Model(std::shared_ptr<std::vector<Vector>> vectors, std::shared_ptr<Args> args);
 
         void nickel_kiela_objective(int32_t source, std::vector<int32_t>& samples, real lr);
 
+        /**
+         * Record the updates made by subsequent calls to
+         * nickel_kiela_objective in `pending` rather than applying them (so
+         * that the vectors are only read), or apply them immediately again if
+         * `pending` is null.
+         */
+        void defer_updates(PendingUpdates* pending);
+
+        /**
+         * Prefetch the vectors that a later call to nickel_kiela_objective
+         * with these arguments will touch.
+         */
+        void prefetch_rows(int32_t source, const std::vector<int32_t>& samples) const;
+
         /**
          * Return a metric on the average performance of this model since the last
          * call to this function (so this function is not idempotent).
@@ -40,38 +94,12 @@ class Model {
         real get_performance();
 
         /**
-         * Update (in place) the poincare point in the direction of its
-         * (poincare-)tangent vector `tangent`. 
-         * Update by adding the tangent vector `tangent` and pulling back inside
-         * the ball, if necessary (in the manner of Nickel & Kiela).
+         * Return the sum of the performance metric over all examples seen by
+         * this model, and the number of those examples (these are not reset
+         * by get_performance).
          */
-        void update(Vector& point, const Vector& tangent);
+        real get_total_performance() const { return total_performance_; }
+        int64_t get_total_examples() const { return total_examples_; }
 };
 
-inline real clip(real value, real min_, real max_) {
-    if (value < min_) {
-        return min_;
-    } else if (value > max_) {
-        return max_;
-    }
-    return value;
-}
-
-/**
- * Compute the poincare ball gradient of hyperbolic distance d(x, v) w.r.t. x,
- * given the various pre-computed scalars.
- */
-inline void distance_gradient(Vector& gradient, const Vector& x, const Vector& v, real sqnormx, real sqnormv, real sqdist, real arccosh_arg) {
-    gradient.zero();
-    real alpha = 1 - sqnormx;
-    real beta = 1 - sqnormv;
-    real a = (sqnormv - 2 * dot(x, v) + 1) / pow(alpha, 2);
-    gradient.add(x, a);
-    gradient.add(v, -1 / alpha);
-    real z = std::max(beta * sqrt(pow(arccosh_arg, 2) - 1), EPS);
-    gradient.multiply(4. / z);
-    // rescale the Euclidean gradient to obtain the Poincaré gradient
-    gradient.multiply(pow(alpha, 2) / 4);
-}
-
 }
@@ -1,53 +1,135 @@
 #include "poincare.h"
+#include "io.h"
 #include <iostream>
-#include <sstream>
 #include <iomanip>
 #include <thread>
 #include <algorithm>
 
 // how many edges to process before reporting on performance
 constexpr int32_t REPORTING_INTERVAL = 50;
+// how many edges ahead of the objective the negative samples are drawn
+constexpr int32_t PIPELINE_DEPTH = 4;
 
 namespace poincare {
 
 Poincare::Poincare(std::shared_ptr<Args> args) {
     args_ = args;
+    verbose_ = true;
+    epoch_objective_sum_ = 0.0;
+    epoch_objective_count_ = 0;
 }
 
-void Poincare::save_vectors(std::string fn) {
-    std::ofstream ofs(fn);
-    if (!ofs.is_open()) {
+Poincare::Poincare(std::shared_ptr<Args> args, std::shared_ptr<Digraph> digraph_, std::shared_ptr<Sampler> sampler_) : Poincare(args) {
+    digraph = digraph_;
+    sampler = sampler_;
+}
+
+std::shared_ptr<Digraph> Poincare::load_digraph(const std::string& fn) {
+    std::ifstream ifs(fn);
+    if (!ifs.is_open()) {
         throw std::invalid_argument(fn + " cannot be opened!");
     }
-    for (int32_t i = 0; i < digraph->node_count(); i++) {
-        std::string name = (digraph->enumeration2node[i])->name;
-        ofs << name << " " << vectors_->at(i) << std::endl;
+    std::shared_ptr<Digraph> result = std::make_shared<Digraph>(ifs);
+    ifs.close();
+    return result;
+}
+
+std::shared_ptr<Sampler> Poincare::build_sampler(Digraph& digraph, real distribution_power, int64_t table_size) {
+    std::vector<int64_t> counts(digraph.node_count());
+    for (int i=0; i < digraph.node_count(); i++) {
+        counts[i] = (digraph.enumeration2node)[i]->count_as_target;
     }
-    ofs.close();
+    return std::make_shared<Sampler>(distribution_power, counts, table_size);
 }
 
-void Poincare::load_vectors(std::string fn) {
-    std::ifstream in(fn);
-    if (!in.is_open()) {
-        throw std::invalid_argument(fn + " cannot be opened!");
+void Poincare::set_verbose(bool verbose) {
+    verbose_ = verbose;
+}
+
+void Poincare::set_epoch_callback(EpochCallback callback) {
+    epoch_callback_ = callback;
+}
+
+std::shared_ptr<std::vector<Vector>> Poincare::get_vectors() const {
+    return vectors_;
+}
+
+real Poincare::objective() const {
+    return epoch_objective_sum_ / std::max<int64_t>(epoch_objective_count_, 1);
+}
+
+/**
+ * Convert the points of the manifold to (newly allocated) points of the
+ * Poincaré ball of the given dimension.
+ */
+template <class Manifold>
+static std::vector<Vector> to_ball_vectors(const std::vector<Vector>& points, int64_t dimension) {
+    std::vector<Vector> ball(points.size(), Vector(dimension));
+    for (size_t i = 0; i < points.size(); i++) {
+        Manifold::to_ball(points[i], ball[i]);
     }
-    std::string line;
-    while (std::getline(in, line)) {
-        std::string field;
-        std::stringstream line_stream(line);
-        // count the fields
-        int col = 0;
-        int32_t offset;
-        while (std::getline(line_stream, field, ' ')) {
-            if (col == 0) {
-                offset = (digraph->name2node).at(field)->enumeration;
-            } else {
-                vectors_->at(offset)[col - 1] = std::stold(field);
-            }
-            col++;
-        }
+    return ball;
+}
+
+/**
+ * Read the vectors of `fn`, which are in Poincaré ball coordinates, into the
+ * points of the manifold of `args`; the points of nodes absent from the file
+ * are left unchanged.
+ */
+static void read_manifold_vectors(const std::string& fn, const Args& args, const Digraph& digraph,
+                                  std::vector<Vector>& points) {
+    if (!is_lorentz(args.manifold)) {
+        read_vectors(fn, digraph, points, args.threads);
+        return;
+    }
+    std::vector<Vector> ball = to_ball_vectors<Lorentz>(points, args.dimension);
+    read_vectors(fn, digraph, ball, args.threads);
+    for (size_t i = 0; i < points.size(); i++) {
+        Lorentz::from_ball(ball[i], points[i]);
     }
-    in.close();
+}
+
+/**
+ * Fill `vectors` with a point per node, uniformly random in each component
+ * but the first, which the projection onto the manifold fixes for Lorentz.
+ */
+template <class Manifold>
+static void random_points(const Args& args, int64_t count, std::vector<Vector>& vectors) {
+    std::minstd_rand rng(args.seed);
+    Vector init_vector(Manifold::coordinates(args.dimension));
+    for (int64_t i=0; i < count; i++) {
+        random_uniform_components(init_vector, rng, args.init_range);
+        Manifold::project(init_vector);
+        vectors.push_back(init_vector);
+    }
+}
+
+std::shared_ptr<std::vector<Vector>> Poincare::initial_vectors(const Args& args, const Digraph& digraph) {
+    std::shared_ptr<std::vector<Vector>> vectors = std::make_shared<std::vector<Vector>>();
+    if (is_lorentz(args.manifold)) {
+        random_points<Lorentz>(args, digraph.enumeration2node.size(), *vectors);
+    } else {
+        random_points<PoincareBall>(args, digraph.enumeration2node.size(), *vectors);
+    }
+    // overwrite the init vectors with any pre-trained vectors
+    if (!(args.input_vectors).empty()) {
+        read_manifold_vectors(args.input_vectors, args, digraph, *vectors);
+    }
+    return vectors;
+}
+
+void Poincare::save_vectors(std::string fn) {
+    if (is_lorentz(args_->manifold)) {
+        // vectors are always written in Poincaré ball coordinates
+        std::vector<Vector> ball = to_ball_vectors<Lorentz>(*vectors_, args_->dimension);
+        write_vectors(fn, *digraph, ball, args_->output_precision, args_->threads);
+    } else {
+        write_vectors(fn, *digraph, *vectors_, args_->output_precision, args_->threads);
+    }
+}
+
+void Poincare::load_vectors(std::string fn) {
+    read_manifold_vectors(fn, *args_, *digraph, *vectors_);
 }
 
 void Poincare::save_checkpoint(int32_t epochs_trained) {
@@ -60,6 +142,18 @@ void Poincare::save_checkpoint(int32_t epochs_trained) {
     }
 }
 
+void Poincare::save_snapshot(int32_t epochs_trained) {
+    if (args_->snapshot_interval > 0 && epochs_trained % args_->snapshot_interval == 0) {
+        TrainingState state;
+        state.epochs_trained = epochs_trained;
+        state.seed = args_->seed;
+        state.threads = args_->threads;
+        state.manifold = args_->manifold;
+        state.schedule = args_->schedule();
+        write_state(args_->output_vectors + ".state", state, *vectors_);
+    }
+}
+
 void Poincare::print_info(clock_t start, real progress, int64_t edges_processed, real lr, real performance) {
     real cpu_time_single_thread = real(clock() - start) / (CLOCKS_PER_SEC * args_->threads);
     real est = real(edges_processed) / cpu_time_single_thread;
@@ -72,98 +166,231 @@ void Poincare::print_info(clock_t start, real progress, int64_t edges_processed,
 }
 
 void Poincare::train() {
-    std::ifstream ifs(args_->graph);
-    if (!ifs.is_open()) {
-        throw std::invalid_argument(args_->graph + " cannot be opened!");
+    if (!digraph) {
+        digraph = load_digraph(args_->graph);
     }
-    digraph = std::make_shared<Digraph>(ifs);
-    ifs.close();
+    std::vector<std::shared_ptr<Args>> phases = args_->phases();
     
     // setup the negative sampler
-    std::vector<int64_t> counts(digraph->node_count());
-    for (int i=0; i < digraph->node_count(); i++) {
-        counts[i] = (digraph->enumeration2node)[i]->count_as_target;
-    }
-    std::cerr << "Generating negative samples...\n";
-    sampler = std::make_shared<Sampler>(args_->distribution_power, counts, NEGATIVE_TABLE_SIZE);
-    // initialise the vectors
-    std::minstd_rand rng(args_->seed);
-    Vector init_vector(args_->dimension);
-    vectors_ = std::make_shared<std::vector<Vector>>();
-    for (int64_t i=0; i < digraph->node_count(); i++) {
-        random_uniform_components(init_vector, rng, args_->init_range);
-        vectors_->push_back(init_vector);
+    if (!sampler) {
+        std::cerr << "Generating negative samples...\n";
+        sampler = build_sampler(*digraph, phases[0]->distribution_power);
     }
-    // overwrite the init vectors with any pre-trained vectors
-    if (!(args_->input_vectors).empty()) {
+    // initialise the vectors, from any pre-trained vectors
+    if (verbose_ && !(args_->input_vectors).empty()) {
         std::cerr << "Loading vectors: " << args_->input_vectors << "\n";
-        load_vectors(args_->input_vectors);
+    }
+    vectors_ = initial_vectors(*args_, *digraph);
+    // overwrite the vectors with those of the run being resumed
+    int32_t resume_epochs = 0;
+    if (!(args_->resume).empty()) {
+        TrainingState state = read_state(args_->resume, args_->manifold, *vectors_);
+        resume_epochs = state.epochs_trained;
+        if (verbose_) {
+            std::cerr << "Resuming after " << resume_epochs << " epochs: " << args_->resume << "\n";
+        }
+        if (state.seed != args_->seed || state.threads != args_->threads) {
+            std::cerr << "Warning: resuming with a different seed or thread count, so training will "
+                      << "not continue as the snapshotted run would have." << std::endl;
+        }
+        std::string schedule = args_->schedule();
+        if (state.schedule != schedule) {
+            std::cerr << "Warning: resuming with a different schedule, so training will not continue as the "
+                      << "snapshotted run would have.\n  snapshot: " << state.schedule
+                      << "\n  now:      " << schedule << std::endl;
+        }
     }
     // start the training!
-    real lr_delta_per_epoch = (args_->start_lr - args_->end_lr) / args_->epochs;;
-    for (int32_t epoch = 0; epoch < args_->epochs; epoch++) {
-        save_checkpoint(epoch);
-        std::cerr << "\rEpoch: " << (epoch + 1) << " / " << args_->epochs << "\n";
-        std::cerr << std::flush;
-        real epoch_start_lr = args_->start_lr - real(epoch) * lr_delta_per_epoch;
-        real epoch_end_lr = args_->start_lr - real(epoch + 1) * lr_delta_per_epoch;
-        std::vector<std::thread> threads;
-        for (int32_t thread_id = 0; thread_id < args_->threads; thread_id++) {
-            int32_t thread_seed = args_->seed + epoch * args_->threads + thread_id;
+    int32_t epochs_trained = 0;
+    for (size_t p = 0; p < phases.size(); p++) {
+        int32_t first_epoch = std::max(resume_epochs - epochs_trained, 0);
+        if (first_epoch < phases[p]->epochs) {
+            if (verbose_ && phases.size() > 1) {
+                std::cerr << "\rPhase: " << (p + 1) << " / " << phases.size() << "\n";
+            }
+            if (!train_phase(phases[p], epochs_trained, first_epoch)) {
+                return; // stopped by the epoch callback
+            }
+        }
+        epochs_trained += phases[p]->epochs;
+    }
+    save_checkpoint(epochs_trained);
+}
+
+bool Poincare::train_phase(std::shared_ptr<Args> phase, int32_t epochs_trained, int32_t first_epoch) {
+    sampler->reweight(phase->distribution_power);
+    real lr_delta_per_epoch = (phase->start_lr - phase->end_lr) / phase->epochs;
+    for (int32_t epoch = first_epoch; epoch < phase->epochs; epoch++) {
+        save_checkpoint(epochs_trained + epoch);
+        if (verbose_) {
+            std::cerr << "\rEpoch: " << (epoch + 1) << " / " << phase->epochs << "\n";
+            std::cerr << std::flush;
+        }
+        epoch_objective_sum_ = 0.0;
+        epoch_objective_count_ = 0;
+        real epoch_start_lr = phase->start_lr - real(epoch) * lr_delta_per_epoch;
+        real epoch_end_lr = phase->start_lr - real(epoch + 1) * lr_delta_per_epoch;
+        if (is_lorentz(phase->manifold)) {
+            train_epoch<Lorentz>(phase, epochs_trained + epoch, epoch_start_lr, epoch_end_lr);
+        } else {
+            train_epoch<PoincareBall>(phase, epochs_trained + epoch, epoch_start_lr, epoch_end_lr);
+        }
+        save_snapshot(epochs_trained + epoch + 1);
+        if (epoch_callback_ && !epoch_callback_(epochs_trained + epoch + 1, objective())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Manifold>
+void Poincare::train_epoch(std::shared_ptr<Args> phase, int32_t epoch, real start_lr, real end_lr) {
+    std::vector<std::thread> threads;
+    std::vector<PendingUpdates> pending(phase->threads, PendingUpdates(phase->threads));
+    Barrier barrier(phase->threads);
+    for (int32_t thread_id = 0; thread_id < phase->threads; thread_id++) {
+        int32_t thread_seed = phase->seed + epoch * phase->threads + thread_id;
+        if (phase->deterministic) {
+            threads.push_back(std::thread([=, &pending, &barrier]() {
+                deterministic_epoch_thread<Manifold>(phase, thread_id, thread_seed, start_lr, end_lr, pending, barrier);
+            }));
+        } else {
             threads.push_back(std::thread([=]() {
-                epoch_thread(thread_id, thread_seed, epoch_start_lr, epoch_end_lr);
+                epoch_thread<Manifold>(phase, thread_id, thread_seed, start_lr, end_lr);
             }));
         }
-        for (auto it = threads.begin(); it != threads.end(); ++it) {
-            it->join();
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+}
+
+void Poincare::draw_samples(const Edge& edge, int32_t number_negatives, std::vector<int32_t>& samples, std::minstd_rand& rng) {
+    samples.clear();
+    // first sample is the positive sample
+    samples.push_back(edge.target.enumeration);
+    // draw some distinct negative samples, excluding positive samples
+    while (samples.size() < number_negatives + 1) {
+        auto next_negative = sampler->get_sample(edge.source.target_enums, rng);
+        if (std::find(samples.begin(), samples.end(), next_negative) != samples.end()) {
+            continue; // already have this sample
         }
+        samples.push_back(next_negative);
     }
-    save_checkpoint(args_->epochs);
 }
 
-void Poincare::epoch_thread(int32_t thread_id, uint32_t seed, real start_lr, real end_lr) {
+template <class Manifold>
+void Poincare::epoch_thread(std::shared_ptr<Args> phase, int32_t thread_id, uint32_t seed, real start_lr, real end_lr) {
     std::minstd_rand rng(1 + seed); // seed 0 and 1 coincide for minstd_rand
-    const int64_t edges_per_thread = digraph->edges.size() / args_->threads;
-    Model model(vectors_, args_);
+    const int64_t edges_per_thread = digraph->edges.size() / phase->threads;
+    const int64_t edge_count = digraph->edges.size();
+    const int64_t stride = phase->threads;
+    Model<Manifold> model(vectors_, phase);
 
     int64_t iter_count = 0; // number processed so far
     clock_t start = clock();
     real lr = start_lr;
     real progress = 0.;
-    std::vector<int32_t> samples;
-    Edge* edge;
-    for (int64_t i = thread_id; i < digraph->edges.size(); i=i+args_->threads) {
-        edge = (digraph->edges)[i];
+    // samples are drawn PIPELINE_DEPTH edges ahead of the objective, and the
+    // rows they reference are prefetched, so that the memory latency of the
+    // random rows overlaps with the computation for the preceding edges.
+    std::vector<std::vector<int32_t>> pipeline(PIPELINE_DEPTH);
+    int64_t next_to_sample = thread_id;
+    for (int32_t slot = 0; slot < PIPELINE_DEPTH && next_to_sample < edge_count; slot++) {
+        const Edge& ahead = *(digraph->edges)[next_to_sample];
+        draw_samples(ahead, phase->number_negatives, pipeline[slot], rng);
+        model.prefetch_rows(ahead.source.enumeration, pipeline[slot]);
+        next_to_sample += stride;
+    }
+    int32_t slot = 0;
+    for (int64_t i = thread_id; i < edge_count; i += stride) {
+        const Edge& edge = *(digraph->edges)[i];
         iter_count++;
-        int32_t source_enum = (edge->source).enumeration;
-        int32_t target_enum = (edge->target).enumeration;
         progress = real(iter_count) / edges_per_thread;
         lr = start_lr * (1.0 - progress) + end_lr * progress;
 
-        samples.clear();
-        // first sample is the positive sample
-        samples.push_back(target_enum);
-        // draw some distinct negative samples, excluding positive samples
-        while (samples.size() < args_->number_negatives + 1) {
-            auto next_negative = sampler->get_sample(edge->source.target_enums, rng);
-			if (std::find(samples.begin(), samples.end(), next_negative) != samples.end()) {
-				continue; // already have this sample
-            }
-            samples.push_back(next_negative);
+        std::vector<int32_t>& samples = pipeline[slot];
+        model.nickel_kiela_objective(edge.source.enumeration, samples, lr);
+
+        // refill the slot just consumed with the samples of a later edge
+        if (next_to_sample < edge_count) {
+            const Edge& ahead = *(digraph->edges)[next_to_sample];
+            draw_samples(ahead, phase->number_negatives, samples, rng);
+            model.prefetch_rows(ahead.source.enumeration, samples);
+            next_to_sample += stride;
         }
+        slot = (slot + 1) % PIPELINE_DEPTH;
 
-        model.nickel_kiela_objective(source_enum, samples, lr);
-        if (thread_id == 0) {
+        if (verbose_ && thread_id == 0) {
             // only thread 0 is responsible for printing progress info
             if (iter_count % REPORTING_INTERVAL == 0) {
                 print_info(start, progress, iter_count, lr, model.get_performance());
             }
         }
     }
-    if (thread_id == 0) {
+    if (verbose_ && thread_id == 0) {
         print_info(start, progress, iter_count, lr, model.get_performance());
         std::cerr << std::endl;
     }
+    std::lock_guard<std::mutex> lock(objective_mutex_);
+    epoch_objective_sum_ += model.get_total_performance();
+    epoch_objective_count_ += model.get_total_examples();
+}
+
+template <class Manifold>
+void Poincare::deterministic_epoch_thread(std::shared_ptr<Args> phase, int32_t thread_id, uint32_t seed,
+        real start_lr, real end_lr, std::vector<PendingUpdates>& pending, Barrier& barrier) {
+    std::minstd_rand rng(1 + seed); // seed 0 and 1 coincide for minstd_rand
+    const int64_t edge_count = digraph->edges.size();
+    const int64_t stride = phase->threads;
+    const int64_t edges_per_thread = edge_count / stride;
+    const int64_t dimension = Manifold::coordinates(phase->dimension);
+    // every thread must take part in the same number of rounds
+    const int64_t max_edges_per_thread = (edge_count + stride - 1) / stride;
+    const int64_t rounds = (max_edges_per_thread + phase->batch_size - 1) / phase->batch_size;
+    Model<Manifold> model(vectors_, phase);
+    model.defer_updates(&pending[thread_id]);
+    Vector tangent(dimension);
+
+    int64_t iter_count = 0; // number processed so far
+    clock_t start = clock();
+    real lr = start_lr;
+    real progress = 0.;
+    std::vector<int32_t> samples;
+    int64_t i = thread_id;
+    for (int64_t round = 0; round < rounds; round++) {
+        // compute the updates for this thread's next batch of edges
+        pending[thread_id].clear();
+        for (int32_t b = 0; b < phase->batch_size && i < edge_count; b++, i += stride) {
+            const Edge& edge = *(digraph->edges)[i];
+            iter_count++;
+            progress = real(iter_count) / edges_per_thread;
+            lr = start_lr * (1.0 - progress) + end_lr * progress;
+            draw_samples(edge, phase->number_negatives, samples, rng);
+            model.nickel_kiela_objective(edge.source.enumeration, samples, lr);
+        }
+        barrier.wait();
+        // apply the updates to the rows owned by this thread, in thread order
+        for (int32_t t = 0; t < stride; t++) {
+            const std::vector<int32_t>& rows = pending[t].rows[thread_id];
+            const std::vector<real>& tangents = pending[t].tangents[thread_id];
+            for (size_t k = 0; k < rows.size(); k++) {
+                std::copy(tangents.begin() + k * dimension, tangents.begin() + (k + 1) * dimension, tangent.data_);
+                Manifold::update((*vectors_)[rows[k]], tangent);
+            }
+        }
+        barrier.wait();
+        if (verbose_ && thread_id == 0) {
+            // only thread 0 is responsible for printing progress info
+            print_info(start, progress, iter_count, lr, model.get_performance());
+        }
+    }
+    if (verbose_ && thread_id == 0) {
+        std::cerr << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(objective_mutex_);
+    epoch_objective_sum_ += model.get_total_performance();
+    epoch_objective_count_ += model.get_total_examples();
 }
 
 }
@@ -2,11 +2,15 @@
 
 #include <random>
 #include <fstream>
+#include <functional>
 #include <memory>
+#include <mutex>
 
 #include "args.h"
+#include "barrier.h"
 #include "digraph.h"
 #include "sampler.h"
+#include "manifold.h"
 #include "model.h"
 #include "real.h"
 #include "vector.h"
@@ -14,6 +18,14 @@
 namespace poincare {
 
 static const int32_t NEGATIVE_TABLE_SIZE = 100000000; // increased from the original
+// entries per node of a negative sampling table sized from the graph
+static const int64_t NEGATIVE_TABLE_ENTRIES_PER_NODE = 1000;
+
+/**
+ * Called after every epoch with the number of epochs trained so far and the
+ * mean objective of the epoch; training stops if it returns false.
+ */
+typedef std::function<bool(int32_t epochs_trained, real objective)> EpochCallback;
 
 class Poincare {
  protected:
@@ -21,20 +33,110 @@ class Poincare {
     std::shared_ptr<Digraph> digraph;
     std::shared_ptr<Sampler> sampler;
 
+    // the points, in the coordinates of the manifold of args_
     std::shared_ptr<std::vector<Vector>> vectors_;
 
-    std::shared_ptr<Model> model_;
+    // whether to report progress on stderr
+    bool verbose_;
+    EpochCallback epoch_callback_;
+    // the objective summed over the edges of the current epoch, by all threads
+    std::mutex objective_mutex_;
+    real epoch_objective_sum_;
+    int64_t epoch_objective_count_;
 
     void save_checkpoint(int32_t epochs_trained);
 
+    /**
+     * Atomically save the full training state to <output-vectors>.state, if
+     * a snapshot is due after this many epochs.
+     */
+    void save_snapshot(int32_t epochs_trained);
+
+    /**
+     * Fill `samples` with the positive sample of `edge` followed by
+     * `number_negatives` distinct negative samples.
+     */
+    void draw_samples(const Edge& edge, int32_t number_negatives, std::vector<int32_t>& samples, std::minstd_rand& rng);
+
+    /**
+     * Train for the epochs of a single phase, with the learning rates,
+     * negatives and distribution power of that phase, reusing the graph,
+     * vectors and (reweighted) sampler.  `epochs_trained` counts the epochs
+     * of the preceding phases; training starts at epoch `first_epoch` of the
+     * phase (non-zero when resuming).  Return false if training was stopped
+     * by the epoch callback.
+     */
+    bool train_phase(std::shared_ptr<Args> phase, int32_t epochs_trained, int32_t first_epoch);
+
+    /**
+     * Train for a single epoch (the `epoch`th overall) on the given manifold,
+     * with the learning rate interpolated from `start_lr` to `end_lr`.
+     */
+    template <class Manifold>
+    void train_epoch(std::shared_ptr<Args> phase, int32_t epoch, real start_lr, real end_lr);
+
  public:
     Poincare(std::shared_ptr<Args> args);
 
+    /**
+     * Construct a Poincare that trains on an already loaded graph and
+     * sampler (which may be shared, read-only, with other instances).
+     */
+    Poincare(std::shared_ptr<Args> args, std::shared_ptr<Digraph> digraph_, std::shared_ptr<Sampler> sampler_);
+
+    /**
+     * Read the graph from the training file `fn`.
+     * Raises an invalid_argument if the file cannot be opened.
+     */
+    static std::shared_ptr<Digraph> load_digraph(const std::string& fn);
+
+    /**
+     * Build the negative sampler for the graph, weighting nodes by their
+     * count as target raised to `distribution_power`, with a table of
+     * `table_size` entries.
+     */
+    static std::shared_ptr<Sampler> build_sampler(Digraph& digraph, real distribution_power,
+                                                  int64_t table_size = NEGATIVE_TABLE_SIZE);
+
+    /**
+     * Return the initial vectors, in the coordinates of args.manifold: random
+     * points near the origin, overwritten by those of args.input_vectors, if
+     * given.
+     */
+    static std::shared_ptr<std::vector<Vector>> initial_vectors(const Args& args, const Digraph& digraph);
+
+    void set_verbose(bool verbose);
+
+    void set_epoch_callback(EpochCallback callback);
+
+    /**
+     * Return the trained vectors, in the coordinates of args.manifold.
+     */
+    std::shared_ptr<std::vector<Vector>> get_vectors() const;
+
+    /**
+     * Return the mean objective over the edges of the last epoch trained.
+     */
+    real objective() const;
+
     void save_vectors(std::string);
     void load_vectors(std::string);
     void print_info(clock_t, real, int64_t, real, real);
 
-    void epoch_thread(int32_t thread_id, uint32_t seed, real start_lr, real end_lr);
+    template <class Manifold>
+    void epoch_thread(std::shared_ptr<Args> phase, int32_t thread_id, uint32_t seed, real start_lr, real end_lr);
+
+    /**
+     * Like epoch_thread, but reproducible: the epoch proceeds in rounds in
+     * which every thread first computes the updates for its next
+     * args->batch_size edges from the (unchanging) vectors, and then, after a
+     * barrier, applies the updates to the rows congruent to its thread_id,
+     * taking the updates of the threads in order.  `pending` holds the
+     * updates of each thread, bucketed by the thread that applies them.
+     */
+    template <class Manifold>
+    void deterministic_epoch_thread(std::shared_ptr<Args> phase, int32_t thread_id, uint32_t seed,
+            real start_lr, real end_lr, std::vector<PendingUpdates>& pending, Barrier& barrier);
     void train();
 
 };
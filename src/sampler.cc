@@ -3,7 +3,13 @@
 
 namespace poincare {
 
-    Sampler::Sampler(real distribution_power_, const std::vector<int64_t>& counts, int64_t table_size) : distribution_power (distribution_power_) {
+    Sampler::Sampler(real distribution_power_, const std::vector<int64_t>& counts_, int64_t table_size_) :
+        counts(counts_), table_size(table_size_), distribution_power(distribution_power_) {
+        fill_table();
+    }
+
+    void Sampler::fill_table() {
+        samples.clear();
         real z = 0.0;
         for (size_t i = 0; i < counts.size(); i++) {
             z += pow(counts[i], distribution_power);
@@ -16,7 +22,15 @@ namespace poincare {
         }
     }
 
-    int32_t Sampler::get_sample(std::vector<int32_t> exclude, std::minstd_rand& rng) const {
+    void Sampler::reweight(real distribution_power_) {
+        if (distribution_power_ == distribution_power) {
+            return;
+        }
+        distribution_power = distribution_power_;
+        fill_table();
+    }
+
+    int32_t Sampler::get_sample(const std::vector<int32_t>& exclude, std::minstd_rand& rng) const {
         int32_t sample;
         do {
             sample = samples[rng() % samples.size()];
@@ -9,7 +9,15 @@ namespace poincare {
 class Sampler {
     protected:
         std::vector<int32_t> samples;
-        const real distribution_power;
+        std::vector<int64_t> counts;
+        const int64_t table_size;
+        real distribution_power;
+
+        /**
+         * Refill the sample table from `counts` at the current
+         * `distribution_power`.
+         */
+        void fill_table();
 
     public:
         /**
@@ -19,9 +27,16 @@ class Sampler {
          **/
         Sampler(real distribution_power_, const std::vector<int64_t>& counts, int64_t table_size);
 
+        /**
+         * Change the power to which the counts are raised, refilling the
+         * table in place (without reallocating) if it differs from the
+         * current power.
+         */
+        void reweight(real distribution_power_);
+
         /**
          * Draw a single sample. 
          */
-        int32_t get_sample(std::vector<int32_t> exclude, std::minstd_rand& rng) const;
+        int32_t get_sample(const std::vector<int32_t>& exclude, std::minstd_rand& rng) const;
 };
 }
@@ -0,0 +1,103 @@
+#include "sweep.h"
+#include "poincare.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace poincare {
+
+struct SweepResult {
+    real objective;
+    double seconds;
+};
+
+static std::string config_path(const std::string& prefix, size_t index) {
+    std::stringstream path;
+    path << prefix << "-config-" << std::setw(4) << std::setfill('0') << index;
+    return path.str();
+}
+
+static void write_summary(const std::string& fn, const std::vector<std::shared_ptr<Args>>& configs,
+                          const std::vector<SweepResult>& results) {
+    std::ofstream ofs(fn);
+    if (!ofs.is_open()) {
+        throw std::invalid_argument(fn + " cannot be opened!");
+    }
+    ofs << "config\toutput\tdimension\tstart-lr\tend-lr\tnumber-negatives\tepochs\tinit-range\tseed\tobjective\tseconds\n";
+    for (size_t c = 0; c < configs.size(); c++) {
+        const Args& config = *configs[c];
+        ofs << c << '\t' << config.output_vectors << '\t' << config.dimension << '\t'
+            << config.start_lr << '\t' << config.end_lr << '\t' << config.number_negatives << '\t'
+            << config.epochs << '\t' << config.init_range << '\t' << config.seed << '\t'
+            << results[c].objective << '\t' << results[c].seconds << '\n';
+    }
+    ofs.close();
+}
+
+void run_sweep(std::shared_ptr<Args> args) {
+    std::vector<std::shared_ptr<Args>> configs = args->sweep_configs();
+    // the sampler is shared, so all the phases must agree on the distribution power
+    std::vector<std::shared_ptr<Args>> phases = args->phases();
+    for (auto phase = phases.begin(); phase != phases.end(); ++phase) {
+        if ((*phase)->distribution_power != phases[0]->distribution_power) {
+            throw std::invalid_argument("sweep mode requires the same distribution power in every phase");
+        }
+    }
+    for (size_t c = 0; c < configs.size(); c++) {
+        configs[c]->threads = 1;
+        configs[c]->output_vectors = config_path(args->output_vectors, c);
+    }
+
+    std::shared_ptr<Digraph> digraph = Poincare::load_digraph(args->graph);
+    std::cerr << "Generating negative samples...\n";
+    std::shared_ptr<Sampler> sampler = Poincare::build_sampler(*digraph, phases[0]->distribution_power);
+
+    std::cerr << "Training " << configs.size() << " configs on " << args->threads << " threads\n";
+    std::vector<SweepResult> results(configs.size());
+    std::atomic<size_t> next_config(0);
+    std::mutex report_mutex;
+    int32_t worker_count = std::min<size_t>(std::max(args->threads, 1), configs.size());
+    std::vector<std::exception_ptr> errors(worker_count);
+    std::vector<std::thread> workers;
+    for (int32_t w = 0; w < worker_count; w++) {
+        workers.push_back(std::thread([&, w]() {
+            try {
+                for (size_t c = next_config++; c < configs.size(); c = next_config++) {
+                    auto start = std::chrono::steady_clock::now();
+                    Poincare poincare(configs[c], digraph, sampler);
+                    poincare.set_verbose(false);
+                    poincare.train();
+                    poincare.save_vectors(configs[c]->output_vectors);
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    results[c].objective = poincare.objective();
+                    results[c].seconds = elapsed.count();
+
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    std::cerr << "Finished " << configs[c]->output_vectors
+                              << "    objective: " << std::fixed << std::setprecision(3) << results[c].objective
+                              << "    seconds: " << std::setprecision(1) << results[c].seconds << std::endl;
+                }
+            } catch (...) {
+                errors[w] = std::current_exception();
+            }
+        }));
+    }
+    for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+    for (auto it = errors.begin(); it != errors.end(); ++it) {
+        if (*it) {
+            std::rethrow_exception(*it);
+        }
+    }
+    write_summary(args->output_vectors + "-sweep.tsv", configs, results);
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+
+#include "args.h"
+
+namespace poincare {
+
+/**
+ * Train an embedding for every point of the sweep grid of `args` (see
+ * Args::sweep_configs), loading the graph and building the negative sampler
+ * only once and sharing them, read-only, between all configs.
+ * The configs are scheduled over a pool of args->threads worker threads,
+ * each config being trained single-threaded (and hence deterministically).
+ * The vectors of the ith config are written to
+ *   <output-vectors>-config-<i>
+ * and a tab-separated summary of the settings, the final objective and the
+ * training time of every config to
+ *   <output-vectors>-sweep.tsv
+ * Raises an invalid_argument if the phases use more than one distribution
+ * power, since the sampler is shared.
+ */
+void run_sweep(std::shared_ptr<Args> args);
+
+}
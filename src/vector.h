@@ -9,6 +9,8 @@
 
 namespace poincare {
 
+static const int64_t CACHE_LINE_SIZE = 64;
+
 class Vector {
 
     public:
@@ -72,6 +74,23 @@ inline real squared_dist(const Vector& v, const Vector& w) {
     return result;
 }
 
+/**
+ * Hint to the processor that the components of the vector are about to be
+ * read and written, so that they can be brought into cache ahead of time.
+ */
+inline void prefetch(const Vector& v) {
+#if defined(__GNUC__)
+    // the rows are only 16-byte aligned, so start at the cache line holding
+    // the first component, lest the last line of the row be missed
+    const uintptr_t first = reinterpret_cast<uintptr_t>(v.data_) & ~uintptr_t(CACHE_LINE_SIZE - 1);
+    const char* begin = reinterpret_cast<const char*>(first);
+    const char* end = reinterpret_cast<const char*>(v.data_ + v.dimension_);
+    for (const char* p = begin; p < end; p += CACHE_LINE_SIZE) {
+        __builtin_prefetch(p, 1);
+    }
+#endif
+}
+
 void random_uniform_components(Vector& vector, std::minstd_rand& rng, real max_value);
 
 }